@@ -0,0 +1,672 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "common.h"
+#include "replay.h"
+#include "info.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <utmpx.h>
+#include <utmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef USE_GETTEXT
+# include <locale.h>
+# include <libintl.h>
+# define _(MSG)  (gettext(MSG))
+#else
+# define _(MSG)  (MSG)
+#endif
+
+
+
+/**
+ * Value returned by getopt_long(3) for --policy.
+ */
+#define OPT_POLICY  256
+
+/**
+ * Value returned by getopt_long(3) for --jobs.
+ */
+#define OPT_JOBS  257
+
+
+
+/**
+ * The outcome of a policy.
+ */
+struct outcome
+{
+  /**
+   * The number of times the machines would have been halted.
+   */
+  unsigned long long int halts;
+  
+  /**
+   * The number of halts after which a user logged in,
+   * and had to wait for the machine to be started.
+   */
+  unsigned long long int disruptions;
+  
+  /**
+   * The number of seconds the machines would have been off.
+   */
+  unsigned long long int saved;
+};
+
+
+/**
+ * Idle periods of a machine, that is, periods
+ * where the machine was on but nobody was logged in.
+ */
+struct gaps
+{
+  /**
+   * The lengths of the periods, in seconds.
+   */
+  unsigned long long int* lengths;
+  
+  /**
+   * `sums[i]` is the sum of `lengths[i]` and
+   * all elements after it, once sorted.
+   */
+  unsigned long long int* sums;
+  
+  /**
+   * The number of elements in `lengths`.
+   */
+  size_t count;
+  
+  /**
+   * The allocation size of `lengths`.
+   */
+  size_t size;
+};
+
+
+/**
+ * The work and the result of a worker thread.
+ */
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+struct worker
+{
+  /**
+   * The thread.
+   */
+  pthread_t thread;
+  
+  /**
+   * The summed outcome of each policy.
+   */
+  struct outcome* outcomes;
+  
+  /**
+   * The file that could not be simulated, `NULL` if none.
+   */
+  const char* failed;
+  
+  /**
+   * The error of the file that could not be simulated.
+   */
+  int error;
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
+/**
+ * `argv[0]` from `main`.
+ */
+static const char* execname;
+
+/**
+ * The wtmp files to simulate.
+ */
+static char** files;
+
+/**
+ * The number of elements in `files`.
+ */
+static size_t nfiles;
+
+/**
+ * The index of the next file to simulate.
+ */
+static size_t next_file = 0;
+
+/**
+ * The interval, in seconds, of each policy, in ascending order.
+ */
+static unsigned long long int* policies = NULL;
+
+/**
+ * The number of elements in `policies`.
+ */
+static size_t npolicies = 0;
+
+
+/**
+ * Print usage information.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int print_help(void)
+{
+  return printf(_("SYNOPSIS\n"
+		  "\t%s [OPTION]... [--] FILE...\n"
+		  "\n"
+		  "DESCRIPTION\n"
+		  "\tautohalt-sim replays the wtmp FILEs, one per machine,\n"
+		  "\tand prints how often the machines would have been\n"
+		  "\thalted, how many hours they would have been off, and\n"
+		  "\thow many times a user would have found a machine off,\n"
+		  "\tfor each policy.\n"
+		  "\n"
+		  "OPTIONS\n"
+		  "\t-h, --help         Print usage information.\n"
+		  "\t-v, --version      Print program name and version.\n"
+		  "\t-c, --copyright    Print copyright information.\n"
+		  "\t    --policy=LIST  The intervals to simulate, such as\n"
+		  "\t                   30m,1h or 5m-4h/5m. Default: 5m-4h/5m.\n"
+		  "\t    --jobs=N       The number of threads to use. Default:\n"
+		  "\t                   the number of online CPUs.\n"
+		  "\n"),
+		execname) < 0 ? -1 : 0;
+}
+
+
+/**
+ * Parse an interval argument.
+ * 
+ * @param   str      The argument.
+ * @param   end      Output parameter for the end of the interval.
+ * @param   seconds  Output parameter for the interval, in seconds.
+ * @return           `NULL` on success, a description of the error
+ *                   if the argument is invalid.
+ */
+static const char* parse_interval(const char* str, const char** end, unsigned long long int* seconds)
+{
+  unsigned long long int temp;
+  char* p;
+  if (!isdigit(*str))
+    return "Interval arguments must be non-negative integers";
+  temp = strtoull(str, &p, 10);
+  switch (*p)
+    {
+    case 'h':  temp *= 60;  /* fall through */
+    case 'm':  temp *= 60;  p++;  break;
+    case 's':  p++;  break;
+    default:   temp *= 60;  break;
+    }
+  if (*p && !strchr(",-/", *p))
+    return "Invalid interval units are 's', 'm', and 'h'";
+  *end = p;
+  *seconds = temp;
+  return NULL;
+}
+
+
+/**
+ * Format an interval with the largest unit
+ * that expresses it exactly.
+ * 
+ * @param  buf      Output buffer, at least 3 * sizeof(seconds) + 2 bytes.
+ * @param  seconds  The interval, in seconds.
+ */
+static void format_interval(char* buf, unsigned long long int seconds)
+{
+  if (seconds % (60 * 60) == 0)
+    sprintf(buf, "%lluh", seconds / (60 * 60));
+  else if (seconds % 60 == 0)
+    sprintf(buf, "%llum", seconds / 60);
+  else
+    sprintf(buf, "%llus", seconds);
+}
+
+
+/**
+ * Compare two policies or idle periods.
+ * 
+ * @param   a  One of the values.
+ * @param   b  The other value.
+ * @return     Negative if `*a` is less than `*b`, positive if
+ *             `*a` is greater than `*b`, zero if they are equal.
+ */
+static int compare_ull(const void* a, const void* b)
+{
+  unsigned long long int x = *(const unsigned long long int*)a;
+  unsigned long long int y = *(const unsigned long long int*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Add policies.
+ * 
+ * @param   str  A comma-separated list of intervals,
+ *               and ranges on the format FIRST-LAST/STEP.
+ * @return       `NULL` on success, a description of the error
+ *               if the argument is invalid, "" on failure.
+ */
+static const char* parse_policies(const char* str)
+{
+  unsigned long long int first, last, step;
+  const char* err;
+  void* new;
+  
+  for (;;)
+    {
+      if ((err = parse_interval(str, &str, &first)))
+	return err;
+      last = first, step = 1;
+      if (*str == '-')
+	{
+	  if ((err = parse_interval(str + 1, &str, &last)))
+	    return err;
+	  if (*str++ != '/')
+	    return "Ranges must be on the format FIRST-LAST/STEP";
+	  if ((err = parse_interval(str, &str, &step)))
+	    return err;
+	  if ((step == 0) || (first > last))
+	    return "Ranges must be on the format FIRST-LAST/STEP";
+	}
+      if ((*str != ',') && (*str != '\0'))
+	return "Invalid list of policies";
+      if (first == 0)
+	return "The interval cannot be zero";
+      
+      for (; first <= last; first += step)
+	{
+	  new = realloc(policies, (npolicies + 1) * sizeof(*policies));
+	  if (new == NULL)
+	    return "";
+	  policies = new;
+	  policies[npolicies++] = first;
+	  if (last - first < step)
+	    break;
+	}
+      
+      if (*str++ == '\0')
+	return NULL;
+    }
+}
+
+
+/**
+ * Record an idle period.
+ * 
+ * @param   gaps    The idle periods.
+ * @param   length  The length of the idle period.
+ * @return          Zero on success, -1 on error.
+ */
+static int add_gap(struct gaps* gaps, time_t length)
+{
+  void* new;
+  if (length <= 0)
+    return 0;
+  if (gaps->count == gaps->size)
+    {
+      gaps->size = gaps->size ? (gaps->size << 1) : 64;
+      new = realloc(gaps->lengths, gaps->size * sizeof(*gaps->lengths));
+      if (new == NULL)
+	return -1;
+      gaps->lengths = new;
+    }
+  gaps->lengths[gaps->count++] = (unsigned long long int)length;
+  return 0;
+}
+
+
+/**
+ * Sort idle periods, and calculate their suffix sums.
+ * 
+ * @param   gaps  The idle periods.
+ * @return        Zero on success, -1 on error.
+ */
+static int prepare_gaps(struct gaps* gaps)
+{
+  size_t i;
+  qsort(gaps->lengths, gaps->count, sizeof(*gaps->lengths), compare_ull);
+  gaps->sums = malloc((gaps->count + 1) * sizeof(*gaps->sums));
+  if (gaps->sums == NULL)
+    return -1;
+  gaps->sums[gaps->count] = 0;
+  for (i = gaps->count; i--;)
+    gaps->sums[i] = gaps->sums[i + 1] + gaps->lengths[i];
+  return 0;
+}
+
+
+/**
+ * Evaluate all policies against sorted idle periods.
+ * Policies are in ascending order, so the idle periods
+ * that are longer than the interval are found by
+ * a single merge-like walk.
+ * 
+ * @param  gaps          The idle periods, prepared with `prepare_gaps`.
+ * @param  outcomes      The outcome of each policy, will be added to.
+ * @param  disruptive    Whether users logged in after the idle periods.
+ */
+static void evaluate(const struct gaps* gaps, struct outcome* outcomes, int disruptive)
+{
+  size_t i, j = 0, k;
+  for (i = 0; i < npolicies; i++)
+    {
+      /* The machine is halted when the interval has elapsed. */
+      while ((j < gaps->count) && (gaps->lengths[j] <= policies[i]))
+	j++;
+      k = gaps->count - j;
+      outcomes[i].halts += k;
+      outcomes[i].saved += gaps->sums[j] - k * policies[i];
+      if (disruptive)
+	outcomes[i].disruptions += k;
+    }
+}
+
+
+/**
+ * The number of records to filter at a time.
+ */
+#ifndef SIMULATION_BLOCK
+# define SIMULATION_BLOCK  4096
+#endif
+
+
+/**
+ * Replay a wtmp file, and evaluate all policies.
+ * 
+ * @param   file      The pathname of the file.
+ * @param   outcomes  The outcome of each policy, will be added to.
+ * @return            Zero on success, -1 on error.
+ */
+static int simulate(const char* file, struct outcome* outcomes)
+{
+  struct gaps by_login, by_shutdown;
+  struct replay state;
+  struct timespec t, idle;
+  struct stat attr;
+  void* map = MAP_FAILED;
+  const struct utmpx* records = NULL;
+  const struct utmpx* u;
+  unsigned int candidates[SIMULATION_BLOCK];
+  size_t i, j, k, m, n = 0, before;
+  int fd, down = 0, r, rc = -1, saved_errno;
+  
+  memset(&by_login, 0, sizeof(by_login));
+  memset(&by_shutdown, 0, sizeof(by_shutdown));
+  memset(&t, 0, sizeof(t));
+  replay_init(&state, &t);
+  
+  fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    goto fail;
+  if (fstat(fd, &attr))
+    goto fail;
+  n = (size_t)(attr.st_size) / sizeof(*records);
+  if (n)
+    {
+      map = mmap(NULL, n * sizeof(*records), PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+      if (map == MAP_FAILED)
+	goto fail;
+      madvise(map, n * sizeof(*records), MADV_SEQUENTIAL);
+      records = map;
+      state.last.tv_sec = (time_t)(records->ut_tv.tv_sec);
+    }
+  
+  /* Most records are only looked at through their type. */
+  for (i = 0; i < n; i += m)
+    {
+      m = n - i < SIMULATION_BLOCK ? n - i : SIMULATION_BLOCK;
+      k = replay_filter(records + i, m, REPLAY_TYPES | (1U << RUN_LVL), candidates);
+      for (j = 0; j < k; j++)
+	{
+	  u = records + i + candidates[j];
+	  t.tv_sec = (time_t)(u->ut_tv.tv_sec);
+	  t.tv_nsec = (long)(u->ut_tv.tv_usec) * 1000L;
+          
+	  /* The machine is off from a shutdown until the next boot. */
+	  if ((u->ut_type == RUN_LVL) && !strncmp(u->ut_user, "shutdown", sizeof(u->ut_user)))
+	    {
+	      if (!down && !state.nlogins)
+		{
+		  replay_idle_time(&state, &t, &idle);
+		  if (add_gap(&by_shutdown, idle.tv_sec))
+		    goto fail;
+		}
+	      down = 1;
+	      state.nlogins = 0;
+	      continue;
+	    }
+          
+	  before = state.nlogins;
+	  r = replay_record(&state, u);
+	  if (r < 0)
+	    goto fail;
+	  if (r == REPLAY_BOOT)
+	    {
+	      /* Without a shutdown record, the machine crashed at an unknown time. */
+	      down = 0;
+	      state.nlogins = 0;
+	    }
+	  else if ((r == REPLAY_LOGIN) && !before)
+	    {
+	      if (!down)
+		{
+		  replay_idle_time(&state, &t, &idle);
+		  if (add_gap(&by_login, idle.tv_sec))
+		    goto fail;
+		}
+	      down = 0;
+	    }
+	}
+    }
+  
+  if (prepare_gaps(&by_login) || prepare_gaps(&by_shutdown))
+    goto fail;
+  evaluate(&by_login, outcomes, 1);
+  evaluate(&by_shutdown, outcomes, 0);
+  rc = 0;
+  
+ fail:
+  saved_errno = errno;
+  if (map != MAP_FAILED)
+    munmap(map, n * sizeof(*records));
+  if (fd >= 0)
+    close(fd);
+  replay_destroy(&state);
+  free(by_login.lengths);
+  free(by_login.sums);
+  free(by_shutdown.lengths);
+  free(by_shutdown.sums);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Simulate files until all have been simulated.
+ * 
+ * @param   data  The worker, `struct worker*`.
+ * @return        `NULL`.
+ */
+static void* work(void* data)
+{
+  struct worker* worker = data;
+  size_t i;
+  
+  while ((i = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED)) < nfiles)
+    if (simulate(files[i], worker->outcomes))
+      {
+	worker->failed = files[i];
+	worker->error = errno;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Simulate idle policies against historical wtmp files.
+ * 
+ * @param   argc  The number of elements in `argv`.
+ * @param   argv  Command line arguments, run with `--help` for more information.
+ * @return        0 on success, 1 on error, 2 on usage error.
+ */
+int main(int argc, char* argv[])
+{
+#define EXIT_USAGE(MSG)  \
+  return fprintf(stderr, _("%s: %s. Type '%s --help' for help.\n"), execname, MSG, execname), 2
+#define USAGE_ASSERT(ASSERTION, MSG)  \
+  do { if (!(ASSERTION))  EXIT_USAGE(MSG); } while (0)
+  
+  struct worker* workers = NULL;
+  struct outcome total;
+  char interval[3 * sizeof(unsigned long long int) + 2];
+  const char* err;
+  long int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t i, j, started = 0;
+  int r, rc = 1;
+  struct option long_options[] =
+    {
+      {"help",       no_argument, NULL, 'h'},
+      {"version",    no_argument, NULL, 'v'},
+      {"copyright",  no_argument, NULL, 'c'},
+      {"policy",     required_argument, NULL, OPT_POLICY},
+      {"jobs",       required_argument, NULL, OPT_JOBS},
+      {NULL,         0,           NULL,  0 }
+    };
+  
+  /* Set up for internationalisation. */
+#if defined(USE_GETTEXT) && defined(PACKAGE) && defined(LOCALEDIR)
+  setlocale(LC_ALL, "");
+  bindtextdomain(PACKAGE, LOCALEDIR);
+  textdomain(PACKAGE);
+#endif
+  
+  /* Parse command line. */
+  execname = argc ? *argv : "autohalt-sim";
+  for (;;)
+    {
+      r = getopt_long(argc, argv, "hvc", long_options, NULL);
+      if      (r == -1)   break;
+      else if (r == 'h')  return -(print_help());
+      else if (r == 'v')  return -(print_version("autohalt-sim"));
+      else if (r == 'c')  return -(print_copyright());
+      else if (r == OPT_POLICY)
+	{
+	  if ((err = parse_policies(optarg)))
+	    {
+	      if (*err)
+		EXIT_USAGE(err);
+	      goto fail;
+	    }
+	}
+      else if (r == OPT_JOBS)
+	{
+	  USAGE_ASSERT(isdigit(*optarg), "The number of jobs must be a positive integer");
+	  jobs = atol(optarg);
+	  USAGE_ASSERT(jobs > 0, "The number of jobs must be a positive integer");
+	}
+      else if (r == '?')
+	EXIT_USAGE(_("Invalid input"));
+      else
+	abort();
+    }
+  USAGE_ASSERT(optind < argc, "No files specified");
+  files = argv + optind;
+  nfiles = (size_t)(argc - optind);
+  if (npolicies == 0)
+    if ((err = parse_policies("5m-4h/5m")))
+      goto fail;
+  qsort(policies, npolicies, sizeof(*policies), compare_ull);
+  if (jobs < 1)
+    jobs = 1;
+  if ((size_t)jobs > nfiles)
+    jobs = (long int)nfiles;
+  
+  /* Simulate, in parallel. */
+  workers = calloc((size_t)jobs, sizeof(*workers));
+  if (workers == NULL)
+    goto fail;
+  for (i = 0; i < (size_t)jobs; i++)
+    {
+      workers[i].outcomes = calloc(npolicies, sizeof(*workers[i].outcomes));
+      if (workers[i].outcomes == NULL)
+	goto fail;
+    }
+  for (; started < (size_t)jobs; started++)
+    if ((errno = pthread_create(&workers[started].thread, NULL, work, workers + started)))
+      break;
+  if (started == 0)
+    goto fail;
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+  for (i = 0; i < started; i++)
+    if (workers[i].failed)
+      {
+	errno = workers[i].error;
+	perror(workers[i].failed);
+	goto done;
+      }
+  
+  /* Report. */
+  if (printf(_("%-12s %12s %14s %12s\n"), _("INTERVAL"), _("HALTS"), _("HOURS SAVED"), _("DISRUPTIONS")) < 0)
+    goto fail;
+  for (i = 0; i < npolicies; i++)
+    {
+      memset(&total, 0, sizeof(total));
+      for (j = 0; j < started; j++)
+	{
+	  total.halts       += workers[j].outcomes[i].halts;
+	  total.disruptions += workers[j].outcomes[i].disruptions;
+	  total.saved       += workers[j].outcomes[i].saved;
+	}
+      format_interval(interval, policies[i]);
+      if (printf("%-12s %12llu %12llu.%llu %12llu\n", interval, total.halts,
+		 total.saved / 3600, total.saved % 3600 / 360, total.disruptions) < 0)
+	goto fail;
+    }
+  if (fflush(stdout))
+    goto fail;
+  rc = 0;
+  goto done;
+  
+ fail:
+  perror(execname);
+ done:
+  if (workers)
+    for (i = 0; i < (size_t)jobs; i++)
+      free(workers[i].outcomes);
+  free(workers);
+  free(policies);
+  return rc;
+}
+
@@ -17,7 +17,11 @@
 #define _GNU_SOURCE /* For getopt_long. */
 #include "common.h"
 #include "check.h"
+#include "trace.h"
 #include "info.h"
+#include "rtc.h"
+#include "net.h"
+#include "coord.h"
 
 #include <getopt.h>
 #include <stdio.h>
@@ -41,6 +45,58 @@
 
 
 
+/**
+ * Value returned by getopt_long(3) for --liveness.
+ */
+#define OPT_LIVENESS  256
+
+/**
+ * Value returned by getopt_long(3) for --trace.
+ */
+#define OPT_TRACE  257
+
+/**
+ * Value returned by getopt_long(3) for --wake.
+ */
+#define OPT_WAKE  258
+
+/**
+ * Value returned by getopt_long(3) for --wake-days.
+ */
+#define OPT_WAKE_DAYS  259
+
+/**
+ * Value returned by getopt_long(3) for --rtc.
+ */
+#define OPT_RTC  260
+
+/**
+ * Value returned by getopt_long(3) for --connections.
+ */
+#define OPT_CONNECTIONS  261
+
+/**
+ * Value returned by getopt_long(3) for --logind.
+ */
+#define OPT_LOGIND  262
+
+/**
+ * Value returned by getopt_long(3) for --coordinator.
+ */
+#define OPT_COORDINATOR  263
+
+/**
+ * Value returned by getopt_long(3) for --wtmp.
+ */
+#define OPT_WTMP  264
+
+/**
+ * Value returned by getopt_long(3) for --lastlog.
+ */
+#define OPT_LASTLOG  265
+
+
+
 /**
  * `argv[0]` from `main`.
  */
@@ -73,6 +129,31 @@ static int print_help(void)
 		  "\t-h, --help         Print usage information.\n"
 		  "\t-v, --version      Print program name and version.\n"
 		  "\t-c, --copyright    Print copyright information.\n"
+		  "\t    --liveness=MODE\n"
+		  "\t                   How to check that logins are active,\n"
+		  "\t                   'fd' (default), 'stat', or, if built\n"
+		  "\t                   with io_uring, 'uring'.\n"
+		  "\t    --trace        Print the decisions stored in the flight\n"
+		  "\t                   recorder.\n"
+		  "\t    --wake=TIME    Program the real-time clock to wake the\n"
+		  "\t                   machine at TIME, on the format HH:MM,\n"
+		  "\t                   before halting it.\n"
+		  "\t    --wake-days=DAYS\n"
+		  "\t                   Only wake the machine on DAYS, such as\n"
+		  "\t                   1-5 for Monday through Friday.\n"
+		  "\t    --rtc=DIR      The real-time clock to use for --wake.\n"
+		  "\t    --connections=LIST\n"
+		  "\t                   Do not halt while any listed TCP port or\n"
+		  "\t                   UNIX socket pathname has a connection.\n"
+		  "\t    --logind[=DIR]\n"
+		  "\t                   Also count graphical sessions from logind.\n"
+		  "\t    --coordinator[=SOCKET]\n"
+		  "\t                   Wait for autohaltd-coord to let the\n"
+		  "\t                   machine halt.\n"
+		  "\t    --wtmp[=FILE]  Also count logins and logouts in wtmp.\n"
+		  "\t    --lastlog[=FILE]\n"
+		  "\t                   Also count the last login of each user\n"
+		  "\t                   in lastlog.\n"
 		  "\n"),
 		execname) < 0 ? -1 : 0;
 }
@@ -92,13 +173,24 @@ int main(int argc, char* argv[])
 #define USAGE_ASSERT(ASSERTION, MSG)  \
   do { if (!(ASSERTION))  EXIT_USAGE(MSG); } while (0)
   
-  int r, have_internal = 0;
+  struct check_report report;
+  int r, slot, waited, have_internal = 0;
   unsigned long long int seconds = 0;
   struct option long_options[] =
     {
       {"help",       no_argument, NULL, 'h'},
       {"version",    no_argument, NULL, 'v'},
       {"copyright",  no_argument, NULL, 'c'},
+      {"liveness",   required_argument, NULL, OPT_LIVENESS},
+      {"trace",      no_argument, NULL, OPT_TRACE},
+      {"wake",       required_argument, NULL, OPT_WAKE},
+      {"wake-days",  required_argument, NULL, OPT_WAKE_DAYS},
+      {"rtc",        required_argument, NULL, OPT_RTC},
+      {"connections", required_argument, NULL, OPT_CONNECTIONS},
+      {"logind",     optional_argument, NULL, OPT_LOGIND},
+      {"coordinator", optional_argument, NULL, OPT_COORDINATOR},
+      {"wtmp",       optional_argument, NULL, OPT_WTMP},
+      {"lastlog",    optional_argument, NULL, OPT_LASTLOG},
       {NULL,         0,           NULL,  0 }
     };
   
@@ -118,6 +210,68 @@ int main(int argc, char* argv[])
       else if (r == 'h')  return -(print_help());
       else if (r == 'v')  return -(print_version("autohalt"));
       else if (r == 'c')  return -(print_copyright());
+      else if (r == OPT_TRACE)
+	{
+	  if (!print_trace())
+	    return 0;
+	  perror(*argv);
+	  return 1;
+	}
+      else if (r == OPT_LIVENESS)
+	{
+#ifdef USE_IO_URING
+	  USAGE_ASSERT(!strcmp(optarg, "fd") || !strcmp(optarg, "stat") || !strcmp(optarg, "uring"),
+		       "Valid liveness modes are 'fd', 'stat', and 'uring'");
+#else
+	  USAGE_ASSERT(!strcmp(optarg, "fd") || !strcmp(optarg, "stat"),
+		       "Valid liveness modes are 'fd' and 'stat'");
+#endif
+	  if (setenv("AUTOHALTD_LIVENESS", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_WAKE)
+	{
+	  USAGE_ASSERT(parse_wake_time(optarg) >= 0, "Wake times must be on the format HH:MM");
+	  if (setenv("AUTOHALTD_WAKE", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_WAKE_DAYS)
+	{
+	  USAGE_ASSERT(parse_wake_days(optarg) >= 0, "Invalid list of weekdays");
+	  if (setenv("AUTOHALTD_WAKE_DAYS", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_RTC)
+	{
+	  if (setenv("AUTOHALTD_RTC", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_CONNECTIONS)
+	{
+	  USAGE_ASSERT(!parse_connections(optarg), "Invalid list of connections");
+	  if (setenv("AUTOHALTD_CONNECTIONS", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_LOGIND)
+	{
+	  if (setenv("AUTOHALTD_LOGIND", optarg ? optarg : AUTOHALTD_LOGIND_DIRECTORY, 1))
+	    goto fail;
+	}
+      else if (r == OPT_COORDINATOR)
+	{
+	  if (setenv("AUTOHALTD_COORD", optarg ? optarg : AUTOHALTD_COORD_PATHNAME, 1))
+	    goto fail;
+	}
+      else if (r == OPT_WTMP)
+	{
+	  if (setenv("AUTOHALTD_WTMP", optarg ? optarg : AUTOHALTD_WTMP_PATHNAME, 1))
+	    goto fail;
+	}
+      else if (r == OPT_LASTLOG)
+	{
+	  if (setenv("AUTOHALTD_LASTLOG", optarg ? optarg : AUTOHALTD_LASTLOG_PATHNAME, 1))
+	    goto fail;
+	}
       else if (r ==  1 )  /* `'-'` would have be some much better than `1`. */
 	{
 	  /* Parse interval parameter. */
@@ -155,13 +309,33 @@ int main(int argc, char* argv[])
   USAGE_ASSERT(!getuid(), "This program must be run as root");
   
   /* How long ago was it that anyone logout? */
-  r = is_time_for_halt(&seconds);
+  r = is_time_for_halt(&seconds, &report);
+  trace_append(&report, r == 0 ? seconds : 0ULL);
   if (r < 0)
     goto fail;
   if (r == 0)
     return 0;
   
-  /* Halt. */
+  /* Wait for our turn, if halts are coordinated, and check again if we had to wait. */
+  slot = acquire_halt_slot(&waited);
+  if ((slot < 0) && errno)
+    perror(*argv); /* Halt anyway. */
+  if ((slot >= 0) && waited)
+    {
+      r = is_time_for_halt(&seconds, &report);
+      trace_append(&report, r == 0 ? seconds : 0ULL);
+      if (r <= 0)
+	{
+	  close(slot);
+	  if (r < 0)
+	    goto fail;
+	  return 0;
+	}
+    }
+  
+  /* Halt, and wake up again in time for the users. */
+  if (set_wake_alarm((time_t)0))
+    perror(*argv);
   halt(argc, argv);
   
  fail:
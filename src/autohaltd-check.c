@@ -17,19 +17,80 @@
 #define _GNU_SOURCE
 #include "common.h"
 #include "check.h"
+#include "trace.h"
+#include "rtc.h"
+#include "coord.h"
+#include "probe.h"
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <signal.h>
+#include <errno.h>
 
 
 
+/**
+ * No idle action has been taken.
+ */
+#define TIER_NONE  0
+
+/**
+ * The machine has been suspended to RAM.
+ */
+#define TIER_SUSPEND  1
+
+/**
+ * The machine has been suspended to disk.
+ */
+#define TIER_HIBERNATE  2
+
+/**
+ * The machine shall be halted.
+ */
+#define TIER_HALT  3
+
+
+
+/**
+ * Get a number from the environment.
+ * 
+ * @param   name  The name of the environment variable.
+ * @return        The value of the environment variable,
+ *                0 if it is not set.
+ */
+static unsigned long long int getenv_ull(const char* name)
+{
+  char* value = getenv(name);
+  return value ? (unsigned long long int)atoll(value) : 0;
+}
+
+
+/**
+ * Store a number in the environment.
+ * 
+ * @param   name   The name of the environment variable.
+ * @param   value  The value of the environment variable.
+ * @return         Zero on success, -1 on error.
+ */
+static int setenv_ull(const char* name, unsigned long long int value)
+{
+  char envval[3 * sizeof(value) + 1];
+  sprintf(envval, "%llu", value);
+  return setenv(name, envval, 1);
+}
+
+
 /**
  * Used by autohaltd to check if its time to shut down,
  * and if so, do so using shutdown(8). If it is not time
  * it exec:s autohaltd-sleep with an adjusted sleep length.
  * 
+ * Before the machine is shut down, it may be suspended,
+ * to RAM and then to disk, if autohaltd was configured
+ * to do so. When the machine resumes, this process image
+ * exec:s itself to check again.
+ * 
  * @param   argc  The number of arguments in `argv`. Must be atleast 1.
  * @param   argv  Command line arguments, the name of the process,
  *                followed by arguments to pass to shutdown(8), in
@@ -38,9 +99,14 @@
  */
 int main(int argc, char* argv[])
 {
-  unsigned long long int seconds;
-  char envval[3 * sizeof(seconds) + 1];
-  int r;
+  static const char* const states[] = {
+    [TIER_SUSPEND]   = "mem",
+    [TIER_HIBERNATE] = "disk",
+  };
+  unsigned long long int seconds, threshold[TIER_HALT + 1];
+  struct check_report report;
+  int r, tier, action, i, slot, waited;
+  time_t since;
   sigset_t set;
   char* seconds_;
   
@@ -59,21 +125,118 @@ int main(int argc, char* argv[])
   if (seconds == 0)
     seconds = (unsigned long long int)(AUTOHALTD_DEFAULT_INTERVAL);
   
-  /* How long ago was it that anyone logout? */
-  r = is_time_for_halt(&seconds);
+  /* Get the idle actions, and which have been taken. An action
+   * is ignored if it would not be taken before the halt. */
+  threshold[TIER_NONE]      = 0;
+  threshold[TIER_SUSPEND]   = getenv_ull("AUTOHALTD_SUSPEND");
+  threshold[TIER_HIBERNATE] = getenv_ull("AUTOHALTD_HIBERNATE");
+  threshold[TIER_HALT]      = seconds;
+  for (i = TIER_SUSPEND; i < TIER_HALT; i++)
+    if (threshold[i] >= threshold[TIER_HALT])
+      threshold[i] = 0;
+    else if (threshold[i] && (threshold[i] < seconds))
+      seconds = threshold[i];
+  tier = (int)getenv_ull("AUTOHALTD_TIER");
+  since = (time_t)getenv_ull("AUTOHALTD_TIER_SINCE");
+  if ((tier < TIER_NONE) || (TIER_HALT <= tier))
+    tier = TIER_NONE;
+  
+  /* How long ago was it that anyone logout? Compare against the first action. */
+  r = is_time_for_halt(&seconds, &report);
   if (r < 0)
-    goto fail;
+    {
+      trace_append(&report, 0ULL);
+      goto fail;
+    }
   if (r == 0)
-    goto resleep;
+    {
+      /* The machine has been used since the last action, if any. */
+      tier = TIER_NONE;
+      trace_append(&report, seconds);
+      goto resleep;
+    }
+  
+  /* The machine may have been used, without being used at any check,
+   * since the last action. In that case, the idle period is a new one. */
+  if (tier != TIER_NONE)
+    {
+      time_t new_since = report.time.tv_sec - (time_t)(report.idle);
+      if ((new_since - since > AUTOHALTD_TIER_SLACK) || (since - new_since > AUTOHALTD_TIER_SLACK))
+	tier = TIER_NONE;
+    }
+  
+  /* Select the last action that is due. */
+  for (action = TIER_HALT; action > TIER_NONE; action--)
+    if (threshold[action] && (threshold[action] <= report.idle))
+      break;
+  
+  /* Find how long it is to the next action. There
+   * is none after the halt, which is never taken. */
+  if (action < TIER_HALT)
+    {
+      for (i = (action > tier ? action : tier) + 1; i < TIER_HALT; i++)
+	if (threshold[i])
+	  break;
+      seconds = threshold[i] - report.idle;
+    }
   
-  /* Halt. */
-  halt(argc, argv);
+  if (action <= tier)
+    {
+      /* The action has already been taken. Wait for the next. */
+      report.reason = REASON_TIER_TAKEN;
+      trace_append(&report, seconds);
+      goto resleep;
+    }
+  
+  if (action == TIER_HALT)
+    {
+      /* Wait for our turn, if halts are coordinated. The machine
+       * may be used meanwhile, so check again if we had to wait. */
+      slot = acquire_halt_slot(&waited);
+      if ((slot < 0) && errno)
+	perror(*argv); /* Halt anyway. */
+      if ((slot >= 0) && waited)
+	{
+	  seconds = threshold[TIER_HALT];
+	  r = is_time_for_halt(&seconds, &report);
+	  if (r <= 0)
+	    {
+	      close(slot);
+	      trace_append(&report, r ? 0ULL : seconds);
+	      if (r < 0)
+		goto fail;
+	      tier = TIER_NONE;
+	      goto resleep;
+	    }
+	}
+      
+      /* Halt, and wake up again in time for the users. */
+      trace_append(&report, 0ULL);
+      if (set_wake_alarm((time_t)0))
+	perror(*argv);
+      halt(argc, argv);
+      goto fail;
+    }
+  
+  /* Suspend, and wake up in time for the next action, or for the users. */
+  report.reason = action == TIER_SUSPEND ? REASON_SUSPEND : REASON_HIBERNATE;
+  trace_append(&report, seconds);
+  if (set_wake_alarm(report.time.tv_sec + (time_t)seconds))
+    perror(*argv);
+  if (setenv_ull("AUTOHALTD_TIER", (unsigned long long int)action) ||
+      setenv_ull("AUTOHALTD_TIER_SINCE", (unsigned long long int)(report.time.tv_sec - (time_t)(report.idle))))
+    goto fail;
+  if (suspend_machine(states[action]))
+    perror(*argv);
+  /* The machine has resumed, it may be time for the next action. */
+  execv(AUTOHALTD_CHECK_PATHNAME, argv);
   goto fail;
   
   /* Sleep. */
  resleep:
-  sprintf(envval, "%llu", seconds);
-  if (setenv("AUTOHALTD_INTERVAL", envval, 1))
+  PROBE2(deadline, seconds, tier);
+  if (setenv_ull("AUTOHALTD_INTERVAL", seconds) ||
+      setenv_ull("AUTOHALTD_TIER", (unsigned long long int)tier))
     goto fail;
   siginterrupt(SIGHUP, 1);
   sigprocmask(SIG_UNBLOCK, &set, NULL);
@@ -82,4 +245,3 @@ int main(int argc, char* argv[])
   perror(*argv);
   return 1;
 }
-
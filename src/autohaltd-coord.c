@@ -0,0 +1,524 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "common.h"
+#include "info.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef USE_GETTEXT
+# include <locale.h>
+# include <libintl.h>
+# define _(MSG)  (gettext(MSG))
+#else
+# define _(MSG)  (MSG)
+#endif
+
+
+
+/**
+ * Value returned by getopt_long(3) for --socket.
+ */
+#define OPT_SOCKET  256
+
+/**
+ * Value returned by getopt_long(3) for --slots.
+ */
+#define OPT_SLOTS  257
+
+/**
+ * Value returned by getopt_long(3) for --jitter.
+ */
+#define OPT_JITTER  258
+
+/**
+ * Value returned by getopt_long(3) for --hold.
+ */
+#define OPT_HOLD  259
+
+
+/**
+ * The client is waiting for a slot.
+ */
+#define CLIENT_QUEUED  0
+
+/**
+ * The client has a slot, but has not been told yet.
+ */
+#define CLIENT_PENDING  1
+
+/**
+ * The client has been told to halt.
+ */
+#define CLIENT_GRANTED  2
+
+/**
+ * The client has closed the connection, but its
+ * slot is held until `hold` seconds after the grant.
+ */
+#define CLIENT_CLOSED  3
+
+
+
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+/**
+ * A machine that wants to halt.
+ */
+struct client
+{
+  /**
+   * The connection, -1 if closed.
+   */
+  int fd;
+  
+  /**
+   * One of the `CLIENT_*` constants.
+   */
+  int state;
+  
+  /**
+   * Whether the client had to wait for its slot.
+   */
+  int waited;
+  
+  /**
+   * The time the client is, or was, granted its slot.
+   */
+  time_t at;
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
+/**
+ * `argv[0]` from `main`.
+ */
+static const char* execname;
+
+/**
+ * The machines that want to halt, in the order they asked.
+ */
+static struct client* clients = NULL;
+
+/**
+ * The number of elements in `clients`.
+ */
+static size_t nclients = 0;
+
+/**
+ * The allocation size of `clients`.
+ */
+static size_t clients_size = 0;
+
+/**
+ * The number of machines that may halt at the same time.
+ */
+static size_t slots = AUTOHALTD_COORD_SLOTS;
+
+/**
+ * The largest number of seconds to delay a halt that had to wait.
+ */
+static unsigned long long int jitter = AUTOHALTD_COORD_JITTER;
+
+/**
+ * The least number of seconds a slot is held after it is granted.
+ */
+static unsigned long long int hold = AUTOHALTD_COORD_HOLD;
+
+/**
+ * Whether the process has been asked to terminate.
+ */
+static volatile sig_atomic_t terminate = 0;
+
+
+
+/**
+ * Print usage information.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int print_help(void)
+{
+  return printf(_("SYNOPSIS\n"
+		  "\t%s [OPTION]...\n"
+		  "\n"
+		  "DESCRIPTION\n"
+		  "\tautohaltd-coord lets a bounded number of machines,\n"
+		  "\trunning autohaltd with --coordinator, halt at the\n"
+		  "\tsame time. The other machines wait for their turn,\n"
+		  "\tand are let to halt at random times, so that they\n"
+		  "\tdo not flood shared storage with I/O.\n"
+		  "\n"
+		  "OPTIONS\n"
+		  "\t-h, --help         Print usage information.\n"
+		  "\t-v, --version      Print program name and version.\n"
+		  "\t-c, --copyright    Print copyright information.\n"
+		  "\t    --socket=PATH  The socket to listen on.\n"
+		  "\t    --slots=N      The number of machines that may halt\n"
+		  "\t                   at the same time. Default: 2.\n"
+		  "\t    --jitter=INTERVAL\n"
+		  "\t                   The longest random delay of a halt\n"
+		  "\t                   that had to wait. Default: 10s.\n"
+		  "\t    --hold=INTERVAL\n"
+		  "\t                   How long a halt lasts at least.\n"
+		  "\t                   Default: 30s.\n"
+		  "\n"),
+		execname) < 0 ? -1 : 0;
+}
+
+
+/**
+ * Parse an interval argument.
+ * 
+ * @param   str      The argument.
+ * @param   seconds  Output parameter for the interval, in seconds.
+ * @return           Zero on success, -1 if the argument is invalid.
+ */
+static int parse_interval(const char* str, unsigned long long int* seconds)
+{
+  char* end;
+  
+  if (!isdigit(*str))
+    return -1;
+  errno = 0;
+  *seconds = strtoull(str, &end, 10);
+  if (errno)
+    return -1;
+  if      (!strcmp(end, "s") || !*end)  ;
+  else if (!strcmp(end, "m"))  *seconds *= 60;
+  else if (!strcmp(end, "h"))  *seconds *= 60 * 60;
+  else
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Invoked when the process is asked to terminate.
+ * 
+ * @param  signo  The signal.
+ */
+static void signal_terminate(int signo)
+{
+  terminate = 1;
+  (void) signo;
+}
+
+
+/**
+ * Get the current time.
+ * 
+ * @return  The current time, in seconds, on the monotonic clock.
+ */
+static time_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+
+/**
+ * Accept a machine that wants to halt.
+ * 
+ * @param   server  The listening socket.
+ * @return          Zero on success, -1 on error.
+ */
+static int accept_client(int server)
+{
+  struct client* new;
+  int fd;
+  
+  fd = accept4(server, NULL, NULL, SOCK_CLOEXEC);
+  if (fd == -1)
+    return ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EAGAIN)) ? 0 : -1;
+  
+  if (nclients == clients_size)
+    {
+      clients_size = clients_size ? (clients_size << 1) : 16;
+      new = realloc(clients, clients_size * sizeof(*clients));
+      if (new == NULL)
+	{
+	  close(fd);
+	  return -1;
+	}
+      clients = new;
+    }
+  memset(clients + nclients, 0, sizeof(*clients));
+  clients[nclients].fd = fd;
+  clients[nclients].state = CLIENT_QUEUED;
+  nclients++;
+  return 0;
+}
+
+
+/**
+ * Grant slots to waiting machines, tell machines that their
+ * slot has been granted, and release slots of machines that
+ * have halted.
+ * 
+ * @param   t  The current time.
+ * @return     The number of seconds until something needs to be
+ *             done again, -1 if nothing needs to be done.
+ */
+static long int update(time_t t)
+{
+  size_t i, j, used = 0;
+  long int timeout = -1, left;
+  char grant;
+  
+  /* Release slots. */
+  for (i = j = 0; i < nclients; i++)
+    if ((clients[i].state != CLIENT_CLOSED) || (t < clients[i].at + (time_t)hold))
+      clients[j++] = clients[i];
+  nclients = j;
+  
+  /* Grant slots, first come first served. */
+  for (i = 0; i < nclients; i++)
+    if (clients[i].state != CLIENT_QUEUED)
+      used++;
+  for (i = 0; (i < nclients) && (used < slots); i++)
+    if (clients[i].state == CLIENT_QUEUED)
+      {
+	clients[i].state = CLIENT_PENDING;
+	clients[i].at = t;
+	if (clients[i].waited && jitter)
+	  clients[i].at += (time_t)((unsigned long long int)random() % (jitter + 1));
+	used++;
+      }
+  
+  for (i = 0; i < nclients; i++)
+    {
+      if (clients[i].state == CLIENT_QUEUED)
+	clients[i].waited = 1;
+      else if ((clients[i].state == CLIENT_PENDING) && (t >= clients[i].at))
+	{
+	  /* The byte tells the machine whether it had to wait, and
+	   * hence whether it must check that it is still idle. */
+	  grant = (char)(clients[i].waited);
+	  if (send(clients[i].fd, &grant, (size_t)1, MSG_NOSIGNAL) != 1)
+	    {
+	      /* The machine no longer wants to halt. */
+	      close(clients[i].fd);
+	      clients[i].fd = -1;
+	      clients[i].state = CLIENT_CLOSED;
+	      clients[i].at = t - (time_t)hold;
+	      return 0;
+	    }
+	  clients[i].state = CLIENT_GRANTED;
+	}
+      
+      /* When is the next grant or release? */
+      if (clients[i].state == CLIENT_PENDING)
+	left = (long int)(clients[i].at - t);
+      else if (clients[i].state == CLIENT_CLOSED)
+	left = (long int)(clients[i].at + (time_t)hold - t);
+      else
+	continue;
+      if ((timeout < 0) || (left < timeout))
+	timeout = left;
+    }
+  return timeout;
+}
+
+
+/**
+ * Handle a closed connection.
+ * 
+ * @param  i  The index of the client.
+ * @param  t  The current time.
+ */
+static void close_client(size_t i, time_t t)
+{
+  close(clients[i].fd);
+  clients[i].fd = -1;
+  if (clients[i].state == CLIENT_GRANTED)
+    {
+      /* The machine is halting, keep its slot for a while. */
+      clients[i].state = CLIENT_CLOSED;
+    }
+  else
+    {
+      /* The machine gave up, or was used, before its turn. */
+      clients[i].state = CLIENT_CLOSED;
+      clients[i].at = t - (time_t)hold;
+    }
+}
+
+
+/**
+ * Let a bounded number of machines halt at the same time.
+ * 
+ * @param   argc  The number of elements in `argv`.
+ * @param   argv  Command line arguments, run with `--help` for more information.
+ * @return        0 on success, 1 on error, 2 on usage error.
+ */
+int main(int argc, char* argv[])
+{
+#define EXIT_USAGE(MSG)  \
+  return fprintf(stderr, _("%s: %s. Type '%s --help' for help.\n"), execname, MSG, execname), 2
+#define USAGE_ASSERT(ASSERTION, MSG)  \
+  do { if (!(ASSERTION))  EXIT_USAGE(MSG); } while (0)
+  
+  const char* path = AUTOHALTD_COORD_PATHNAME;
+  struct sockaddr_un addr;
+  struct pollfd* pfds = NULL;
+  struct pollfd* new;
+  size_t i, n, pfds_size = 0;
+  long int timeout;
+  time_t t;
+  int r, server = -1, rc = 1;
+  char byte;
+  struct option long_options[] =
+    {
+      {"help",       no_argument, NULL, 'h'},
+      {"version",    no_argument, NULL, 'v'},
+      {"copyright",  no_argument, NULL, 'c'},
+      {"socket",     required_argument, NULL, OPT_SOCKET},
+      {"slots",      required_argument, NULL, OPT_SLOTS},
+      {"jitter",     required_argument, NULL, OPT_JITTER},
+      {"hold",       required_argument, NULL, OPT_HOLD},
+      {NULL,         0,           NULL,  0 }
+    };
+  
+  /* Set up for internationalisation. */
+#if defined(USE_GETTEXT) && defined(PACKAGE) && defined(LOCALEDIR)
+  setlocale(LC_ALL, "");
+  bindtextdomain(PACKAGE, LOCALEDIR);
+  textdomain(PACKAGE);
+#endif
+  
+  /* Parse command line. */
+  execname = argc ? *argv : "autohaltd-coord";
+  for (;;)
+    {
+      r = getopt_long(argc, argv, "hvc", long_options, NULL);
+      if      (r == -1)   break;
+      else if (r == 'h')  return -(print_help());
+      else if (r == 'v')  return -(print_version("autohaltd-coord"));
+      else if (r == 'c')  return -(print_copyright());
+      else if (r == OPT_SOCKET)
+	{
+	  USAGE_ASSERT(*optarg && (strlen(optarg) < sizeof(addr.sun_path)), "Invalid socket pathname");
+	  path = optarg;
+	}
+      else if (r == OPT_SLOTS)
+	{
+	  USAGE_ASSERT(isdigit(*optarg), "The number of slots must be a positive integer");
+	  slots = (size_t)atol(optarg);
+	  USAGE_ASSERT(slots > 0, "The number of slots must be a positive integer");
+	}
+      else if (r == OPT_JITTER)
+	USAGE_ASSERT(!parse_interval(optarg, &jitter), "Invalid jitter");
+      else if (r == OPT_HOLD)
+	USAGE_ASSERT(!parse_interval(optarg, &hold), "Invalid hold time");
+      else if (r == '?')
+	EXIT_USAGE(_("Invalid input"));
+      else
+	abort();
+    }
+  USAGE_ASSERT(optind == argc, "Too many arguments");
+  
+  signal(SIGTERM, signal_terminate);
+  signal(SIGINT, signal_terminate);
+  srandom((unsigned int)time(NULL) ^ (unsigned int)getpid());
+  
+  /* Listen. A stale socket from an earlier run is replaced. */
+  server = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (server == -1)
+    goto fail;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(server, (void*)&addr, (socklen_t)sizeof(addr)))
+    goto fail;
+  if (listen(server, SOMAXCONN))
+    goto fail;
+  
+  while (!terminate)
+    {
+      t = now();
+      timeout = update(t);
+      
+      if (pfds_size < nclients + 1)
+	{
+	  new = realloc(pfds, (pfds_size = nclients + 1) * sizeof(*pfds));
+	  if (new == NULL)
+	    goto fail;
+	  pfds = new;
+	}
+      pfds[0].fd = server;
+      pfds[0].events = POLLIN;
+      for (i = 0; i < nclients; i++)
+	{
+	  pfds[i + 1].fd = clients[i].fd; /* Ignored if -1. */
+	  pfds[i + 1].events = POLLIN;
+	}
+      n = nclients;
+      
+      r = poll(pfds, (nfds_t)(n + 1), timeout < 0 ? -1 : (int)(timeout > 3600 ? 3600 : timeout) * 1000);
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  goto fail;
+	}
+      
+      /* Machines only write to close, or by misbehaving. */
+      t = now();
+      for (i = 0; i < n; i++)
+	if (pfds[i + 1].revents && (clients[i].fd >= 0) && (read(clients[i].fd, &byte, (size_t)1) <= 0))
+	  close_client(i, t);
+      if ((pfds[0].revents & POLLIN) && accept_client(server))
+	goto fail;
+    }
+  
+  rc = 0;
+  goto done;
+  
+ fail:
+  perror(execname);
+ done:
+  if (server >= 0)
+    {
+      close(server);
+      unlink(path);
+    }
+  for (i = 0; i < nclients; i++)
+    if (clients[i].fd >= 0)
+      close(clients[i].fd);
+  free(clients);
+  free(pfds);
+  return rc;
+}
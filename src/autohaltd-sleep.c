@@ -14,12 +14,25 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "common.h"
+#include "source.h"
+#include "logind.h"
+#include "input.h"
+#include "inhibit.h"
+#include "notify.h"
+#include "pressure.h"
+#include "mounts.h"
+#include "clock.h"
+#include "probe.h"
 
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
 
 
 
@@ -28,6 +41,24 @@
  */
 static volatile sig_atomic_t received_update = 0;
 
+/**
+ * The activity sources.
+ */
+static const struct source* const sources[] = {
+  &logind_source,
+  &input_source,
+  &inhibit_source,
+  &notify_source,
+  &pressure_source,
+  &mounts_source,
+};
+
+/**
+ * The activity sources that could not be watched,
+ * one bit per source. These are ignored.
+ */
+static unsigned long int disabled = 0;
+
 
 
 /**
@@ -42,6 +73,87 @@ static void signal_update(int signo)
 }
 
 
+/**
+ * Sleep until a timeout, or a signal, while watching the activity sources.
+ * 
+ * @param   epfd     The epoll(7) instance with the activity sources.
+ * @param   seconds  The timeout, in seconds, at most 65535.
+ * @return           The number of seconds left of the timeout,
+ *                   -1 if an activity source requested a check.
+ */
+static long int wait_for(int epfd, unsigned seconds)
+{
+  struct epoll_event events[16];
+  struct timespec start, now;
+  time_t left, next;
+  unsigned i;
+  int n, r, rc, fd, saved_errno;
+  
+  clock_now(CLOCK_MONOTONIC, &start);
+  for (;;)
+    {
+      clock_now(CLOCK_MONOTONIC, &now);
+      left = (time_t)seconds - (now.tv_sec - start.tv_sec);
+      if (left <= 0)
+	return 0;
+      if (received_update)
+	return (long int)left; /* Arrived outside epoll_wait. */
+      for (i = 0; i < sizeof(sources) / sizeof(*sources); i++)
+	if (!(disabled & (1UL << i)) && sources[i]->tick &&
+	    (next = sources[i]->tick(epfd, i, now.tv_sec)) && (next < left))
+	  left = next;
+      
+      n = clock_epoll_wait(epfd, events, (int)(sizeof(events) / sizeof(*events)), (int)left * 1000);
+      if (n < 0)
+	{
+	  saved_errno = errno;
+	  clock_now(CLOCK_MONOTONIC, &now);
+	  left = (time_t)seconds - (now.tv_sec - start.tv_sec);
+	  if (left <= 0)
+	    return 0;
+	  if (saved_errno == EINTR)
+	    return (long int)left;
+	  /* Returning would call us again at once, and spin. */
+	  errno = saved_errno;
+	  perror("autohaltd-sleep");
+	  return (long int)clock_sleep((unsigned)left);
+	}
+      for (r = 0; n--;)
+	{
+	  i = SOURCE_INDEX(events[n].data.u64);
+	  fd = SOURCE_FD(events[n].data.u64);
+	  if (disabled & (1UL << i))
+	    {
+	      /* Registered before the source failed to open. */
+	      epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	      continue;
+	    }
+	  rc = sources[i]->handle(epfd, i, fd, events[n].events);
+	  if (rc < 0)
+	    perror("autohaltd-sleep");
+	  r |= rc > 0;
+	}
+      if (r)
+	{
+	  PROBE(sleep_woken);
+	  return -1;
+	}
+    }
+}
+
+
+/**
+ * Store the state of the activity sources in the environment.
+ */
+static void save_sources(void)
+{
+  unsigned i;
+  for (i = 0; i < sizeof(sources) / sizeof(*sources); i++)
+    if (!(disabled & (1UL << i)) && sources[i]->save && sources[i]->save())
+      perror("autohaltd-sleep");
+}
+
+
 /**
  * Used by autohaltd to sleep for an extended time.
  * When the sleep is done, the process exec:s into
@@ -61,7 +173,13 @@ static void signal_update(int signo)
 int main(int argc, char* argv[])
 {
   unsigned long long int seconds;
+  unsigned long int reported;
   unsigned partial_seconds;
+  char envval[3 * sizeof(long int) + 2];
+  const char* reported_;
+  long int left;
+  unsigned i;
+  int epfd;
   
   /* Get sleep interval, and validate `argc`. */
   {
@@ -78,6 +196,23 @@ int main(int argc, char* argv[])
   /* Set up signal hander for online updating. */
   signal(SIGHUP, signal_update);
   
+  /* Watch the activity sources. If that fails, just sleep. A source
+   * that cannot be watched is ignored, but the others are watched,
+   * and the error is only reported the first time in a row. */
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  reported_ = getenv("AUTOHALTD_SOURCE_ERRORS");
+  reported = reported_ ? strtoul(reported_, NULL, 10) : 0;
+  for (i = 0; (epfd >= 0) && (i < sizeof(sources) / sizeof(*sources)); i++)
+    if (sources[i]->open(epfd, i))
+      {
+	disabled |= 1UL << i;
+	if (!(reported & (1UL << i)))
+	  perror(*argv);
+      }
+  sprintf(envval, "%lu", disabled);
+  if (setenv("AUTOHALTD_SOURCE_ERRORS", envval, 1))
+    perror(*argv);
+  
   /* Sleep. */
   while (seconds > 0)
     {
@@ -85,9 +220,17 @@ int main(int argc, char* argv[])
 	partial_seconds = 65535U;
       else
 	partial_seconds = (unsigned)seconds;
-      seconds -= partial_seconds - sleep(partial_seconds);
+      PROBE2(sleep_armed, partial_seconds, seconds);
+      if (epfd < 0)
+	seconds -= partial_seconds - clock_sleep(partial_seconds);
+      else if ((left = wait_for(epfd, partial_seconds)) < 0)
+	break;
+      else
+	seconds -= partial_seconds - (unsigned long long int)left;
       if (received_update)
 	{
+	  PROBE(sighup);
+	  save_sources();
 	  execv(AUTOHALTD_SLEEP_PATHNAME, argv);
 	  perror(*argv);
 	  received_update = 0;
@@ -95,6 +238,7 @@ int main(int argc, char* argv[])
     }
   
   /* Perhaps shutdown. */
+  save_sources();
   execv(AUTOHALTD_CHECK_PATHNAME, argv);
   perror(*argv);
   return 1;
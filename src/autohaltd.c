@@ -17,6 +17,11 @@
 #define _GNU_SOURCE /* For getopt_long. */
 #include "common.h"
 #include "info.h"
+#include "rtc.h"
+#include "net.h"
+#include "cgroup.h"
+#include "notify.h"
+#include "mounts.h"
 
 #include <getopt.h>
 #include <stdio.h>
@@ -40,6 +45,88 @@
 
 
 
+/**
+ * Value returned by getopt_long(3) for --liveness.
+ */
+#define OPT_LIVENESS  256
+
+/**
+ * Value returned by getopt_long(3) for --wake.
+ */
+#define OPT_WAKE  257
+
+/**
+ * Value returned by getopt_long(3) for --wake-days.
+ */
+#define OPT_WAKE_DAYS  258
+
+/**
+ * Value returned by getopt_long(3) for --rtc.
+ */
+#define OPT_RTC  259
+
+/**
+ * Value returned by getopt_long(3) for --suspend.
+ */
+#define OPT_SUSPEND  260
+
+/**
+ * Value returned by getopt_long(3) for --hibernate.
+ */
+#define OPT_HIBERNATE  261
+
+/**
+ * Value returned by getopt_long(3) for --connections.
+ */
+#define OPT_CONNECTIONS  262
+
+/**
+ * Value returned by getopt_long(3) for --logind.
+ */
+#define OPT_LOGIND  263
+
+/**
+ * Value returned by getopt_long(3) for --cgroup.
+ */
+#define OPT_CGROUP  264
+
+/**
+ * Value returned by getopt_long(3) for --cgroup-threshold.
+ */
+#define OPT_CGROUP_THRESHOLD  265
+
+/**
+ * Value returned by getopt_long(3) for --input.
+ */
+#define OPT_INPUT  266
+
+/**
+ * Value returned by getopt_long(3) for --coordinator.
+ */
+#define OPT_COORDINATOR  267
+
+/**
+ * Value returned by getopt_long(3) for --wtmp.
+ */
+#define OPT_WTMP  268
+
+/**
+ * Value returned by getopt_long(3) for --lastlog.
+ */
+#define OPT_LASTLOG  269
+
+/**
+ * Value returned by getopt_long(3) for --pressure.
+ */
+#define OPT_PRESSURE  270
+
+/**
+ * Value returned by getopt_long(3) for --mounts.
+ */
+#define OPT_MOUNTS  271
+
+
+
 /**
  * `argv[0]` from `main`.
  */
@@ -74,11 +161,85 @@ static int print_help(void)
 		  "\t-v, --version      Print program name and version.\n"
 		  "\t-c, --copyright    Print copyright information.\n"
 		  "\t-f, --foreground   Do not daemonise the process.\n"
+		  "\t    --liveness=MODE\n"
+		  "\t                   How to check that logins are active,\n"
+		  "\t                   'fd' (default), 'stat', or, if built\n"
+		  "\t                   with io_uring, 'uring'.\n"
+		  "\t    --wake=TIME    Program the real-time clock to wake the\n"
+		  "\t                   machine at TIME, on the format HH:MM,\n"
+		  "\t                   before halting it.\n"
+		  "\t    --wake-days=DAYS\n"
+		  "\t                   Only wake the machine on DAYS, such as\n"
+		  "\t                   1-5 for Monday through Friday.\n"
+		  "\t    --rtc=DIR      The real-time clock to use for --wake.\n"
+		  "\t    --suspend=INTERVAL\n"
+		  "\t                   Suspend the machine to RAM when INTERVAL\n"
+		  "\t                   has elapsed since the last user logout.\n"
+		  "\t    --hibernate=INTERVAL\n"
+		  "\t                   Suspend the machine to disk when INTERVAL\n"
+		  "\t                   has elapsed since the last user logout.\n"
+		  "\t    --connections=LIST\n"
+		  "\t                   Do not halt while any listed TCP port or\n"
+		  "\t                   UNIX socket pathname has a connection.\n"
+		  "\t    --logind[=DIR]\n"
+		  "\t                   Also count graphical sessions from logind.\n"
+		  "\t    --cgroup=LIST  Do not let logins that are not used, as\n"
+		  "\t                   measured in the listed cgroups, such as\n"
+		  "\t                   user.slice, keep the machine up.\n"
+		  "\t    --cgroup-threshold=PERCENT[,BYTES]\n"
+		  "\t                   The CPU usage, in percent of one CPU, and\n"
+		  "\t                   the I/O, in bytes per second, at which\n"
+		  "\t                   the cgroups are in use.\n"
+		  "\t    --input[=DIR]  Do not let logins keep the machine up, but\n"
+		  "\t                   input to the devices in DIR.\n"
+		  "\t    --coordinator[=SOCKET]\n"
+		  "\t                   Wait for autohaltd-coord to let the\n"
+		  "\t                   machine halt.\n"
+		  "\t    --wtmp[=FILE]  Also count logins and logouts in wtmp.\n"
+		  "\t    --lastlog[=FILE]\n"
+		  "\t                   Also count the last login of each user\n"
+		  "\t                   in lastlog.\n"
+		  "\t    --pressure[=DIR]\n"
+		  "\t                   Also count CPU and I/O pressure, from\n"
+		  "\t                   the files in DIR, as activity.\n"
+		  "\t    --mounts=LIST  Also count writes to files on the listed\n"
+		  "\t                   mounts, such as /home, as activity.\n"
 		  "\n"),
 		execname) < 0 ? -1 : 0;
 }
 
 
+/**
+ * Parse an interval argument.
+ * 
+ * @param   str      The argument.
+ * @param   seconds  Output parameter for the interval, in seconds.
+ * @return           `NULL` on success, a description of the error
+ *                   if the argument is invalid.
+ */
+static const char* parse_interval(const char* str, unsigned long long int* seconds)
+{
+  long long int temp;
+  char* p;
+  if (!isdigit(*str))
+    return "Interval arguments must be non-negative integers";
+  temp = strtoll(str, &p, 10);
+  if (strlen(p) >= 2)
+    return "Invalid interval units are 's', 'm', and 'h'";
+  switch (*p)
+    {
+    case 'h':  temp *= 60;  /* fall through */
+    case 0:
+    case 'm':  temp *= 60;  /* fall through */
+    case 's':  break;
+    default:
+      return "Invalid interval units are 's', 'm', and 'h'";
+    }
+  *seconds = (unsigned long long int)temp;
+  return NULL;
+}
+
+
 /**
  * Daemonise the process
  * 
@@ -229,6 +390,22 @@ int main(int argc, char* argv[])
       {"version",    no_argument, NULL, 'v'},
       {"copyright",  no_argument, NULL, 'c'},
       {"foreground", no_argument, NULL, 'f'},
+      {"liveness",   required_argument, NULL, OPT_LIVENESS},
+      {"wake",       required_argument, NULL, OPT_WAKE},
+      {"wake-days",  required_argument, NULL, OPT_WAKE_DAYS},
+      {"rtc",        required_argument, NULL, OPT_RTC},
+      {"suspend",    required_argument, NULL, OPT_SUSPEND},
+      {"hibernate",  required_argument, NULL, OPT_HIBERNATE},
+      {"connections", required_argument, NULL, OPT_CONNECTIONS},
+      {"logind",     optional_argument, NULL, OPT_LOGIND},
+      {"cgroup",     required_argument, NULL, OPT_CGROUP},
+      {"cgroup-threshold", required_argument, NULL, OPT_CGROUP_THRESHOLD},
+      {"input",      optional_argument, NULL, OPT_INPUT},
+      {"coordinator", optional_argument, NULL, OPT_COORDINATOR},
+      {"wtmp",       optional_argument, NULL, OPT_WTMP},
+      {"lastlog",    optional_argument, NULL, OPT_LASTLOG},
+      {"pressure",   optional_argument, NULL, OPT_PRESSURE},
+      {"mounts",     required_argument, NULL, OPT_MOUNTS},
       {NULL,         0,           NULL,  0 }
     };
   
@@ -249,25 +426,125 @@ int main(int argc, char* argv[])
       else if (r == 'v')  return -(print_version("autohaltd"));
       else if (r == 'c')  return -(print_copyright());
       else if (r == 'f')  foreground = 1;
+      else if (r == OPT_LIVENESS)
+	{
+#ifdef USE_IO_URING
+	  USAGE_ASSERT(!strcmp(optarg, "fd") || !strcmp(optarg, "stat") || !strcmp(optarg, "uring"),
+		       "Valid liveness modes are 'fd', 'stat', and 'uring'");
+#else
+	  USAGE_ASSERT(!strcmp(optarg, "fd") || !strcmp(optarg, "stat"),
+		       "Valid liveness modes are 'fd' and 'stat'");
+#endif
+	  if (setenv("AUTOHALTD_LIVENESS", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_WAKE)
+	{
+	  USAGE_ASSERT(parse_wake_time(optarg) >= 0, "Wake times must be on the format HH:MM");
+	  if (setenv("AUTOHALTD_WAKE", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_WAKE_DAYS)
+	{
+	  USAGE_ASSERT(parse_wake_days(optarg) >= 0, "Invalid list of weekdays");
+	  if (setenv("AUTOHALTD_WAKE_DAYS", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_RTC)
+	{
+	  if (setenv("AUTOHALTD_RTC", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_SUSPEND)
+	{
+	  unsigned long long int temp;
+	  const char* err;
+	  if ((err = parse_interval(optarg, &temp)))
+	    EXIT_USAGE(err);
+	  USAGE_ASSERT(temp, "The interval cannot be zero");
+	  sprintf(envval, "%llu", temp);
+	  if (setenv("AUTOHALTD_SUSPEND", envval, 1))
+	    goto fail;
+	}
+      else if (r == OPT_HIBERNATE)
+	{
+	  unsigned long long int temp;
+	  const char* err;
+	  if ((err = parse_interval(optarg, &temp)))
+	    EXIT_USAGE(err);
+	  USAGE_ASSERT(temp, "The interval cannot be zero");
+	  sprintf(envval, "%llu", temp);
+	  if (setenv("AUTOHALTD_HIBERNATE", envval, 1))
+	    goto fail;
+	}
+      else if (r == OPT_CONNECTIONS)
+	{
+	  USAGE_ASSERT(!parse_connections(optarg), "Invalid list of connections");
+	  if (setenv("AUTOHALTD_CONNECTIONS", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_LOGIND)
+	{
+	  if (setenv("AUTOHALTD_LOGIND", optarg ? optarg : AUTOHALTD_LOGIND_DIRECTORY, 1))
+	    goto fail;
+	}
+      else if (r == OPT_CGROUP)
+	{
+	  USAGE_ASSERT(*optarg, "Invalid list of cgroups");
+	  if (setenv("AUTOHALTD_CGROUP", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_CGROUP_THRESHOLD)
+	{
+	  USAGE_ASSERT(!parse_cgroup_threshold(optarg, NULL, NULL), "Invalid cgroup threshold");
+	  if (setenv("AUTOHALTD_CGROUP_THRESHOLD", optarg, 1))
+	    goto fail;
+	}
+      else if (r == OPT_INPUT)
+	{
+	  if (setenv("AUTOHALTD_INPUT", optarg ? optarg : AUTOHALTD_INPUT_DIRECTORY, 1))
+	    goto fail;
+	}
+      else if (r == OPT_COORDINATOR)
+	{
+	  if (setenv("AUTOHALTD_COORD", optarg ? optarg : AUTOHALTD_COORD_PATHNAME, 1))
+	    goto fail;
+	}
+      else if (r == OPT_WTMP)
+	{
+	  if (setenv("AUTOHALTD_WTMP", optarg ? optarg : AUTOHALTD_WTMP_PATHNAME, 1))
+	    goto fail;
+	}
+      else if (r == OPT_LASTLOG)
+	{
+	  if (setenv("AUTOHALTD_LASTLOG", optarg ? optarg : AUTOHALTD_LASTLOG_PATHNAME, 1))
+	    goto fail;
+	}
+      else if (r == OPT_PRESSURE)
+	{
+	  if (setenv("AUTOHALTD_PRESSURE", optarg ? optarg : AUTOHALTD_PRESSURE_DIRECTORY, 1))
+	    goto fail;
+	}
+      else if (r == OPT_MOUNTS)
+	{
+	  /* fanotify(7) would watch the mount that contains a path
+	   * that is not a mount point. Check once, rather than at
+	   * each sleep, where the path is skipped if it is not. */
+	  if ((r = check_mounts(optarg)) < 0)
+	    goto fail;
+	  USAGE_ASSERT(r, "Each of the --mounts must be a mount point");
+	  if (setenv("AUTOHALTD_MOUNTS", optarg, 1))
+	    goto fail;
+	}
       else if (r ==  1 )  /* `'-'` would have be some much better than `1`. */
 	{
 	  /* Parse interval parameter. */
-	  long long int temp;
-	  char* p;
+	  unsigned long long int temp;
+	  const char* err;
 	  have_internal = 1;
-	  USAGE_ASSERT(isdigit(*optarg), "Interval arguments must be non-negative integers");
-	  temp = strtoll(optarg, &p, 10);
-	  USAGE_ASSERT(strlen(p) < 2, "Invalid interval units are 's', 'm', and 'h'");
-	  switch (*p)
-	    {
-	    case 'h':  temp *= 60;  /* fall through */
-	    case 0:
-	    case 'm':  temp *= 60;  /* fall through */
-	    case 's':  break;
-	    default:
-	      EXIT_USAGE("Invalid interval units are 's', 'm', and 'h'");
-	    }
-	  seconds += (unsigned long long int)temp;
+	  if ((err = parse_interval(optarg, &temp)))
+	    EXIT_USAGE(err);
+	  seconds += temp;
 	}
       else if (r == '?')
 	EXIT_USAGE(_("Invalid input"));
@@ -293,11 +570,40 @@ int main(int argc, char* argv[])
   if (setenv("AUTOHALTD_INTERVAL_PROPER", envval, 1))
     goto fail;
   
+  /* No idle action has been taken yet, and no activity has been seen. */
+  if (unsetenv("AUTOHALTD_TIER") ||
+      unsetenv("AUTOHALTD_CGROUP_SAMPLE") ||
+      unsetenv("AUTOHALTD_CGROUP_BUSY") ||
+      unsetenv("AUTOHALTD_INPUT_LAST") ||
+      unsetenv("AUTOHALTD_PRESSURE_LAST") ||
+      unsetenv("AUTOHALTD_MOUNTS_LAST") ||
+      unsetenv("AUTOHALTD_LEDGER") ||
+      unsetenv("AUTOHALTD_WTMP_STATE") ||
+      unsetenv("AUTOHALTD_INHIBITED") ||
+      unsetenv("AUTOHALTD_NOTIFY_FD") ||
+      unsetenv("AUTOHALTD_SESSIONS") ||
+      unsetenv("AUTOHALTD_SESSION_CLOSED") ||
+      unsetenv("AUTOHALTD_SOURCE_ERRORS"))
+    goto fail;
+  
+  /* Let any process keep the machine up, by holding a lock on
+   * a file in the inhibitor directory. Like /tmp, the sticky
+   * bit keeps the processes from removing each other's files.
+   * Without it, nothing can inhibit the halt, but that is all. */
+  if (mkdir(AUTOHALTD_INHIBIT_DIRECTORY, 01777) ? (errno != EEXIST) : chmod(AUTOHALTD_INHIBIT_DIRECTORY, 01777))
+    perror(execname);
+  
   /* Daemonisation. */
   if (!foreground)
     if (daemonise())
       goto fail;
   
+  /* Listen for pam_autohalt.so, after daemonisation, which closes
+   * inherited file descriptors. Without the socket, closed sessions
+   * are noticed at the next check, as if the module was not used. */
+  if (open_notify_socket())
+    perror(execname);
+  
   /* Get interrupted. */
   siginterrupt(SIGTERM, 1);
   siginterrupt(SIGHUP, 1);
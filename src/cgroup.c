@@ -0,0 +1,287 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "cgroup.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <alloca.h>
+
+
+
+/**
+ * The size of the buffer used to read a statistics file.
+ * Longer files are truncated, io.stat has one line per device.
+ */
+#define CGROUP_STAT_SIZE  8192
+
+
+
+/**
+ * Cumulative resource usage of the monitored cgroups.
+ */
+struct sample
+{
+  /**
+   * When the sample was taken, in microseconds
+   * of `CLOCK_MONOTONIC`.
+   */
+  unsigned long long int time;
+  
+  /**
+   * CPU time used, in microseconds.
+   */
+  unsigned long long int cpu;
+  
+  /**
+   * Bytes read and written.
+   */
+  unsigned long long int io;
+};
+
+
+
+/**
+ * Parse a cgroup activity threshold on the format
+ * "PERCENT[,BYTES]", where PERCENT is the CPU usage in
+ * percent of one CPU, and BYTES is the I/O throughput
+ * in bytes per second.
+ * 
+ * @param   str  The string to parse.
+ * @param   cpu  Output parameter for the CPU threshold,
+ *               may be `NULL`.
+ * @param   io   Output parameter for the I/O threshold,
+ *               may be `NULL`. Set to `AUTOHALTD_CGROUP_IO_THRESHOLD`
+ *               if BYTES is omitted.
+ * @return       Zero if valid, -1 if invalid.
+ */
+int parse_cgroup_threshold(const char* str, unsigned long long int* cpu, unsigned long long int* io)
+{
+  unsigned long long int cpu_, io_ = (unsigned long long int)(AUTOHALTD_CGROUP_IO_THRESHOLD);
+  char* end;
+  
+  if ((*str < '0') || ('9' < *str))
+    return -1;
+  errno = 0;
+  cpu_ = strtoull(str, &end, 10);
+  if (*end == ',')
+    {
+      str = end + 1;
+      if ((*str < '0') || ('9' < *str))
+	return -1;
+      io_ = strtoull(str, &end, 10);
+    }
+  if (*end || errno)
+    return -1;
+  
+  if (cpu)  *cpu = cpu_;
+  if (io)   *io = io_;
+  return 0;
+}
+
+
+/**
+ * Read a statistics file of a cgroup.
+ * 
+ * @param   dir   The pathname of the cgroup.
+ * @param   file  The name of the file.
+ * @param   buf   Buffer of `CGROUP_STAT_SIZE` bytes,
+ *                will be NUL-terminated.
+ * @return        Zero on success, -1 on error. If the cgroup does
+ *                not exist, `buf` is emptied, and zero is returned.
+ */
+static int read_stat(const char* dir, const char* file, char* buf)
+{
+  char* path;
+  size_t have = 0;
+  ssize_t got;
+  int fd, saved_errno;
+  
+  if (*dir == '/')
+    {
+      path = alloca(strlen(dir) + strlen(file) + 2);
+      stpcpy(stpcpy(stpcpy(path, dir), "/"), file);
+    }
+  else
+    {
+      path = alloca(sizeof(AUTOHALTD_CGROUP_DIRECTORY "/") + strlen(dir) + strlen(file) + 1);
+      stpcpy(stpcpy(stpcpy(stpcpy(path, AUTOHALTD_CGROUP_DIRECTORY "/"), dir), "/"), file);
+    }
+  
+  *buf = '\0';
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return errno == ENOENT ? 0 : -1; /* For example, a user's slice after logout. */
+  
+  while (have < CGROUP_STAT_SIZE - 1)
+    {
+      got = read(fd, buf + have, CGROUP_STAT_SIZE - 1 - have);
+      if (got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  saved_errno = errno;
+	  close(fd);
+	  errno = saved_errno;
+	  return -1;
+	}
+      if (got == 0)
+	break;
+      have += (size_t)got;
+    }
+  buf[have] = '\0';
+  
+  close(fd);
+  return 0;
+}
+
+
+/**
+ * Add the usage of a cgroup to a sample.
+ * 
+ * @param   dir     The pathname of the cgroup, not
+ *                  necessarily NUL-terminated.
+ * @param   len     The length of `dir`.
+ * @param   sample  The sample to add to.
+ * @param   buf     Buffer of `CGROUP_STAT_SIZE` bytes.
+ * @return          Zero on success, -1 on error.
+ */
+static int add_usage(const char* dir, size_t len, struct sample* sample, char* buf)
+{
+  char* path = alloca(len + 1);
+  const char* p;
+  
+  memcpy(path, dir, len);
+  path[len] = '\0';
+  
+  /* "usage_usec N" is the first line of cpu.stat. */
+  if (read_stat(path, "cpu.stat", buf))
+    return -1;
+  for (p = buf; p && *p; p = strchr(p, '\n'), p = p ? p + 1 : NULL)
+    if (!strncmp(p, "usage_usec ", sizeof("usage_usec ") - 1))
+      {
+	sample->cpu += strtoull(p + sizeof("usage_usec ") - 1, NULL, 10);
+	break;
+      }
+  
+  /* io.stat has a line per device, "MAJ:MIN rbytes=N wbytes=N rios=N ...". */
+  if (read_stat(path, "io.stat", buf))
+    return -1;
+  for (p = buf; (p = strstr(p, "bytes=")); p += sizeof("bytes=") - 1)
+    if ((p - buf >= 2) && (p[-2] == ' ') && ((p[-1] == 'r') || (p[-1] == 'w')))
+      sample->io += strtoull(p + sizeof("bytes=") - 1, NULL, 10);
+  
+  return 0;
+}
+
+
+/**
+ * Sample the CPU usage and I/O of the cgroups listed, comma-separated,
+ * in the environment variable AUTOHALTD_CGROUP, and get how long it
+ * has been since they were last in use, that is, since the usage
+ * between two samples was at or above the threshold in the
+ * environment variable AUTOHALTD_CGROUP_THRESHOLD.
+ * 
+ * The sample and the time the cgroups were last in use are
+ * stored in the environment variables AUTOHALTD_CGROUP_SAMPLE
+ * and AUTOHALTD_CGROUP_BUSY, for the next call, which may
+ * be made by another process image.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of seconds
+ *                since the cgroups were last in use.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_CGROUP is not
+ *                set or there is no earlier sample, -1 on error.
+ */
+int get_cgroup_idle_time(time_t now, unsigned long long int* idle)
+{
+  const char* list = getenv("AUTOHALTD_CGROUP");
+  const char* threshold = getenv("AUTOHALTD_CGROUP_THRESHOLD");
+  const char* old_ = getenv("AUTOHALTD_CGROUP_SAMPLE");
+  const char* busy_ = getenv("AUTOHALTD_CGROUP_BUSY");
+  unsigned long long int cpu_threshold = (unsigned long long int)(AUTOHALTD_CGROUP_CPU_THRESHOLD);
+  unsigned long long int io_threshold = (unsigned long long int)(AUTOHALTD_CGROUP_IO_THRESHOLD);
+  unsigned long long int elapsed;
+  struct sample old, new;
+  struct timespec mono;
+  char buf[CGROUP_STAT_SIZE];
+  char envval[3 * 3 * sizeof(unsigned long long int) + 3];
+  const char* end;
+  time_t busy;
+  
+  if ((list == NULL) || (*list == '\0'))
+    return 0;
+  if (threshold && parse_cgroup_threshold(threshold, &cpu_threshold, &io_threshold))
+    return errno = EINVAL, -1;
+  
+  /* Take a sample. */
+  if (clock_now(CLOCK_MONOTONIC, &mono))
+    return -1;
+  memset(&new, 0, sizeof(new));
+  new.time = (unsigned long long int)(mono.tv_sec) * 1000000ULL;
+  new.time += (unsigned long long int)(mono.tv_nsec) / 1000ULL;
+  for (;; list = end + 1)
+    {
+      end = strchrnul(list, ',');
+      if ((end != list) && add_usage(list, (size_t)(end - list), &new, buf))
+	return -1;
+      if (*end == '\0')
+	break;
+    }
+  
+  /* Compare with the previous sample. The monotonic clock does
+   * not advance while the machine is suspended, so the average
+   * is only taken over the time the machine was running. */
+  if ((old_ == NULL) || (sscanf(old_, "%llu %llu %llu", &old.time, &old.cpu, &old.io) != 3) ||
+      (old.time >= new.time))
+    busy = now; /* No usable sample, assume the cgroups are in use. */
+  else
+    {
+      elapsed = new.time - old.time;
+      busy = busy_ ? (time_t)atoll(busy_) : now;
+#ifdef DEBUG
+      fprintf(stderr, "cgroup usage over %llu us: cpu=%llu us, io=%llu B\n",
+	      elapsed, new.cpu - old.cpu, new.io - old.io);
+#endif
+      if ((new.cpu < old.cpu) || (new.io < old.io))
+	busy = now; /* A cgroup was removed or recreated. */
+      else if ((new.cpu - old.cpu) * 100ULL >= cpu_threshold * elapsed)
+	busy = now;
+      else if ((new.io - old.io) >= io_threshold * elapsed / 1000000ULL)
+	busy = now;
+    }
+  
+  /* Remember it for next time. */
+  sprintf(envval, "%llu %llu %llu", new.time, new.cpu, new.io);
+  if (setenv("AUTOHALTD_CGROUP_SAMPLE", envval, 1))
+    return -1;
+  sprintf(envval, "%lli", (long long int)busy);
+  if (setenv("AUTOHALTD_CGROUP_BUSY", envval, 1))
+    return -1;
+  
+  if ((old_ == NULL) || (busy > now))
+    return 0;
+  *idle = (unsigned long long int)(now - busy);
+  return 1;
+}
+
@@ -0,0 +1,56 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+
+/**
+ * Parse a cgroup activity threshold on the format
+ * "PERCENT[,BYTES]", where PERCENT is the CPU usage in
+ * percent of one CPU, and BYTES is the I/O throughput
+ * in bytes per second.
+ * 
+ * @param   str  The string to parse.
+ * @param   cpu  Output parameter for the CPU threshold,
+ *               may be `NULL`.
+ * @param   io   Output parameter for the I/O threshold,
+ *               may be `NULL`. Set to `AUTOHALTD_CGROUP_IO_THRESHOLD`
+ *               if BYTES is omitted.
+ * @return       Zero if valid, -1 if invalid.
+ */
+int parse_cgroup_threshold(const char* str, unsigned long long int* cpu, unsigned long long int* io);
+
+/**
+ * Sample the CPU usage and I/O of the cgroups listed, comma-separated,
+ * in the environment variable AUTOHALTD_CGROUP, and get how long it
+ * has been since they were last in use, that is, since the usage
+ * between two samples was at or above the threshold in the
+ * environment variable AUTOHALTD_CGROUP_THRESHOLD.
+ * 
+ * The sample and the time the cgroups were last in use are
+ * stored in the environment variables AUTOHALTD_CGROUP_SAMPLE
+ * and AUTOHALTD_CGROUP_BUSY, for the next call, which may
+ * be made by another process image.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of seconds
+ *                since the cgroups were last in use.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_CGROUP is not
+ *                set or there is no earlier sample, -1 on error.
+ */
+int get_cgroup_idle_time(time_t now, unsigned long long int* idle);
+
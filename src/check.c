@@ -16,6 +16,19 @@
  */
 #define _GNU_SOURCE
 #include "check.h"
+#include "net.h"
+#include "logind.h"
+#include "cgroup.h"
+#include "replay.h"
+#include "input.h"
+#include "ledger.h"
+#include "inhibit.h"
+#include "history.h"
+#include "notify.h"
+#include "pressure.h"
+#include "mounts.h"
+#include "clock.h"
+#include "probe.h"
 #include "common.h"
 
 #include <stdlib.h>
@@ -29,7 +42,14 @@
 #include <errno.h>
 #include <stdint.h>
 #include <time.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#ifdef USE_IO_URING
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
 
 
 
@@ -89,231 +109,786 @@ static int is_login(struct utmpx* u, int* active)
 
 
 /**
- * Get the number of active logins, and the time of
- * since the last logout.
+ * Check whether a NORMAL_PROCESS record represents a login,
+ * by comparing the controlling terminal and the state of
+ * the login process, as listed in /proc/<pid>/stat, against
+ * the terminal. Unlike `is_login`, this is not fooled by
+ * redirected standard input, output, or error, and it only
+ * requires one read per login.
  * 
- * @param   duration  Output parameter for the time since the last logout.
- * @return            The number of active logins, truncated to `INT_MAX`
- *                    in the impossible event that there are more logins.
- *                    -1 on error.
+ * @param   u       The login record.
+ * @param   active  Will be set to 1 if active, 0 if inactive.
+ * @return          1 if it is a login, 0 otherwise.
  */
-static int get_number_of_logins_and_last_logout(struct timespec* duration)
+static int is_login_by_stat(struct utmpx* u, int* active)
 {
-#define ADJUST_NSEC(ts)						\
-  do								\
-    {								\
-      if ((ts)->tv_nsec > 1000000000L)				\
-	(ts)->tv_nsec -= 1000000000L, (ts)->tv_sec += 1;	\
-      else if ((ts)->tv_nsec < 0L)				\
-	(ts)->tv_nsec += 1000000000L, (ts)->tv_sec -= 1;	\
-    }								\
-  while (0)
-#ifdef _HAVE_UT_TV
-# define SET_TIMESPEC(ts, u)					\
-  ((ts)->tv_sec = (time_t)((u)->ut_tv.tv_sec),			\
-   (ts)->tv_nsec = (long)((u)->ut_tv.tv_usec) * 1000L)
-#else
-# define SET_TIMESPEC(ts, u)					\
-  ((ts)->tv_sec = (time_t)((u)->ut_time),			\
-   (ts)->tv_nsec = 0)
-#endif
+  char line[sizeof(DEVDIR "/") / sizeof(char) + UT_LINESIZE];
+  char path[sizeof(PROCDIR "//stat") / sizeof(char) + 3 * sizeof(pid_t)];
+  char buf[256];
+  struct stat ttyattr;
+  unsigned long int tty_nr;
+  char* p;
+  ssize_t n;
+  int fd, field;
+  
+  memcpy(line, DEVDIR "/", sizeof(DEVDIR "/"));
+  memcpy(line + sizeof(DEVDIR) / sizeof(char), u->ut_line, UT_LINESIZE * sizeof(char));
+  line[sizeof(line) / sizeof(char) - 1] = '\0';
+  
+  if (stat(line, &ttyattr))
+    return 0;
+  if (S_ISCHR(ttyattr.st_mode) == 0)
+    return 0;
+  
+  *active = 0;
+  
+  sprintf(path, "%s/%ji/stat", PROCDIR, (intmax_t)(u->ut_pid));
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return 1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 1;
+  buf[n] = '\0';
+  
+  /* The format is "pid (comm) state ppid pgrp session tty_nr ...", and
+   * comm may contain any character, but it cannot be longer than 16
+   * bytes, so everything up to and including tty_nr is in `buf`. */
+  p = strrchr(buf, ')');
+  if ((p == NULL) || (p[1] != ' '))
+    return 1;
+  p += 2;
+  if ((*p == 'Z') || (*p == 'X') || (*p == 'x'))
+    {
 #ifdef DEBUG
-# define DEBUF_PRINT_TIME(label, ts)				\
-  fprintf(stderr, "%s: %lli.%09lis\n", label, (unsigned long long int)((ts).tv_sec), (ts).tv_nsec)
-#else
-# define DEBUF_PRINT_TIME(label, ts)  /* Do nothing. */
+      fprintf(stderr, "Login process %ji is dead\n", (intmax_t)(u->ut_pid));
 #endif
+      return 1;
+    }
+  for (field = 0; field < 4; field++)
+    if ((p = strchr(p, ' ')) == NULL)
+      return 1;
+    else
+      p++;
+  tty_nr = strtoul(p, NULL, 10);
   
+  /* tty_nr is encoded as by the kernel's new_encode_dev. */
+  *active = ((((tty_nr >> 8) & 0xFFFUL) == major(ttyattr.st_rdev)) &&
+	     (((tty_nr & 0xFFUL) | ((tty_nr >> 12) & 0xFFF00UL)) == minor(ttyattr.st_rdev)));
+#ifdef DEBUG
+  if (*active == 0)
+    fprintf(stderr, "Login process %ji is controlled by another terminal than /dev/%s\n",
+	    (intmax_t)(u->ut_pid), u->ut_line);
+#endif
+  return 1;
+}
+
+
+#ifdef USE_IO_URING
 #ifdef __GNUC__
 # pragma GCC diagnostic push
 # pragma GCC diagnostic ignored "-Wpadded"
 #endif
-  struct utmpx* u;
-  int rc = 0, saved_errno, active;
-  pid_t* logins = NULL;
-  size_t logins_ptr = 0;
-  size_t logins_size = 0;
-  struct utmpx* obsolete = NULL;
-  size_t obsolete_ptr = 0;
-  size_t obsolete_size = 0;
-  size_t i;
-  void* new;
-  struct timespec delta;
-  struct timespec now;
-  struct timespec oldtime;
-  struct timespec newtime;
-  int have_oldtime = 0;
+/**
+ * The paths and results for the stat(2):s required to
+ * check whether a NORMAL_PROCESS record represents a login.
+ */
+struct probe
+{
+  /**
+   * The pathname of the login's terminal.
+   */
+  char line[sizeof(DEVDIR "/") / sizeof(char) + UT_LINESIZE];
+  
+  /**
+   * The pathnames of the login process's standard
+   * input, standard output, and standard error.
+   */
+  char fd[3][sizeof(PROCDIR "//fd/") / sizeof(char) + 3 * sizeof(pid_t) + 3 * sizeof(int)];
+  
+  /**
+   * The attributes of the files named by `line`, `fd[0]`,
+   * `fd[1]`, and `fd[2]`, in that order.
+   */
+  struct statx attr[4];
+  
+  /**
+   * The return values of the statx(2):s, one for each `attr`.
+   */
+  int res[4];
+};
 #ifdef __GNUC__
 # pragma GCC diagnostic pop
 #endif
+
+
+/**
+ * The largest number of submission queue entries
+ * to request for liveness probing.
+ */
+#ifndef AUTOHALTD_URING_ENTRIES
+# define AUTOHALTD_URING_ENTRIES  1024
+#endif
+
+
+/**
+ * Check whether two files are the same file.
+ * 
+ * @param   a  The attributes of one of the files.
+ * @param   b  The attributes of the other file.
+ * @return     1 if they are the same file, 0 otherwise.
+ */
+static int is_same_file(const struct statx* a, const struct statx* b)
+{
+  return (a->stx_ino == b->stx_ino) && (a->stx_mode == b->stx_mode) &&
+    (a->stx_dev_major == b->stx_dev_major) && (a->stx_dev_minor == b->stx_dev_minor) &&
+    (a->stx_rdev_major == b->stx_rdev_major) && (a->stx_rdev_minor == b->stx_rdev_minor);
+}
+
+
+/**
+ * Check whether the kernel can stat(2) with io_uring(7).
+ * Kernels that cannot, predate IORING_REGISTER_PROBE.
+ * 
+ * @param   ring  The io_uring(7) instance.
+ * @return        1 if IORING_OP_STATX is supported, 0 otherwise.
+ */
+static int have_uring_statx(int ring)
+{
+  struct io_uring_probe* probe;
+  int r = 0;
   
-  if (clock_gettime(CLOCK_REALTIME, &now))
+  probe = calloc((size_t)1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+  if (probe == NULL)
+    return 0;
+  if (!syscall((long)__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, 256))
+    r = (probe->last_op >= IORING_OP_STATX) && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return r;
+}
+
+
+/**
+ * Check which of a set of NORMAL_PROCESS records represent
+ * logins, and which of those are active. All stat(2):s are
+ * submitted as a single batch, per filled ring, with io_uring(7).
+ * 
+ * @param   us       The login records.
+ * @param   n        The number of elements in `us`.
+ * @param   verdict  Output parameter for each record: -1 if it is not
+ *                   a login, 0 if it is an inactive login, and 1 if
+ *                   it is an active login.
+ * @return           0 on success, -1 if io_uring is unavailable.
+ */
+static int probe_logins_batched(const struct utmpx* us, size_t n, signed char* verdict)
+{
+#define URING_ENTER(fd, submit, wait)  \
+  syscall((long)__NR_io_uring_enter, fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0)
+  
+  struct io_uring_params params;
+  struct io_uring_sqe* sqes = MAP_FAILED;
+  struct io_uring_sqe* sqe;
+  struct io_uring_cqe* cqe;
+  struct probe* probes = NULL;
+  struct probe* p;
+  char* sq = MAP_FAILED;
+  char* cq = MAP_FAILED;
+  size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+  size_t i, j, k, off, chunk, reaped;
+  unsigned entries = 4, tail, head, mask, idx;
+  long int submitted;
+  int ring, rc = -1, saved_errno;
+  
+  if (n == 0)
+    return 0;
+  while ((entries < AUTOHALTD_URING_ENTRIES) && (entries < 4 * n))
+    entries <<= 1;
+  
+  memset(&params, 0, sizeof(params));
+  ring = (int)syscall((long)__NR_io_uring_setup, entries, &params);
+  if (ring < 0)
     return -1;
-  *duration = now;
-  memset(&delta, 0, sizeof(delta));
-  DEBUF_PRINT_TIME("Current time", *duration);
+  if (!have_uring_statx(ring))
+    {
+      errno = ENOSYS;
+      goto done;
+    }
   
-  setutxent();
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+  cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+  sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+  if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (sqes == MAP_FAILED))
+    goto done;
   
-  while ((u = getutxent()))
-    switch (u->ut_type)
-      {
-	/* Strings are not necessarily terminated! */
-	
-      /* Not LOGIN_PROCESS, the login process changes LOGIN_PROCESS
-       * to USER_PROCESS. LOGIN_PROCESS indicates getty, or a login
-       * that has been be completed. */
-      case USER_PROCESS:
-	if (!is_login(u, &active))
-	  continue;
-#ifdef DEBUG
-	fprintf(stderr, "Login: pid=%ji, user=%s, line=%s, host=%s, active=%s\n",
-		(intmax_t)(u->ut_pid), u->ut_line, u->ut_user, u->ut_host, (active ? "yes" : "no"));
+  chunk = params.sq_entries / 4;
+  probes = malloc((n < chunk ? n : chunk) * sizeof(*probes));
+  if (probes == NULL)
+    goto done;
+  
+  for (off = 0; off < n; off += k)
+    {
+      k = n - off < chunk ? n - off : chunk;
+      
+      /* Queue the stat:s of the terminals and the file descriptors. */
+      mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+      tail = *(unsigned*)(sq + params.sq_off.tail);
+      for (i = 0; i < k; i++)
 	{
-	  struct timespec ts;
-	  SET_TIMESPEC(&ts, u);
-	  DEBUF_PRINT_TIME("Login time", ts);
+	  p = probes + i;
+	  memcpy(p->line, DEVDIR "/", sizeof(DEVDIR "/"));
+	  memcpy(p->line + sizeof(DEVDIR) / sizeof(char), us[off + i].ut_line, UT_LINESIZE * sizeof(char));
+	  p->line[sizeof(p->line) / sizeof(char) - 1] = '\0';
+	  for (j = 0; j < 3; j++)
+	    sprintf(p->fd[j], "%s/%ji/fd/%zu", PROCDIR, (intmax_t)(us[off + i].ut_pid), j);
+	  for (j = 0; j < 4; j++, tail++)
+	    {
+	      idx = tail & mask;
+	      sqe = sqes + idx;
+	      memset(sqe, 0, sizeof(*sqe));
+	      sqe->opcode = IORING_OP_STATX;
+	      sqe->fd = AT_FDCWD;
+	      sqe->addr = (__u64)(uintptr_t)(j ? p->fd[j - 1] : p->line);
+	      sqe->len = STATX_BASIC_STATS;
+	      sqe->off = (__u64)(uintptr_t)(p->attr + j);
+	      sqe->user_data = (__u64)(i * 4 + j);
+	      ((unsigned*)(sq + params.sq_off.array))[idx] = idx;
+	    }
 	}
-#endif
-	if (!active)
-	  goto inactive_login;
-	if (logins_ptr == logins_size)
-	  {
-	    logins_size = logins_size ? (logins_size << 1) : 16;
-	    new = realloc(logins, logins_size * sizeof(*logins));
-	    if (new == NULL)
-	      goto fail;
-	    logins = new;
-	  }
-	logins[logins_ptr++] = u->ut_pid;
-	if (rc < INT_MAX)
-	  rc++;
-	break;
-      inactive_login:
-	if (obsolete_ptr == obsolete_size)
-	  {
-	    obsolete_size = obsolete_size ? (obsolete_size << 1) : 16;
-	    new = realloc(obsolete, obsolete_size * sizeof(*obsolete));
-	    if (new == NULL)
-	      goto fail;
-	    obsolete = new;
-	  }
-	obsolete[obsolete_ptr++] = *u;
-	break;
-	
-      case DEAD_PROCESS:
-      case LOGIN_PROCESS: /* See above. */
-      case INIT_PROCESS: /* Spawned by init, potentially a getty. */
-	for (i = 0; i < logins_ptr; i++)
-	  if (logins[i] == u->ut_pid)
-	    break;
-#ifdef DEBUG
-	fprintf(stderr, "Logout: pid=%ji, type=%s\n", (intmax_t)(u->ut_pid),
-		u->ut_type == DEAD_PROCESS ? "dead" : u->ut_type == LOGIN_PROCESS ? "login" : "init");
-#endif
-	if (i < logins_ptr)
-	  {
-	    memmove(logins + i, logins + i + 1, (--logins_ptr - i) * sizeof(*logins));
-	    if ((0 < rc) && (rc < INT_MAX))
-	      rc--;
-	  }
-	SET_TIMESPEC(duration, u);
-	memset(&delta, 0, sizeof(delta));
-	DEBUF_PRINT_TIME("Logout time", *duration);
-	break;
-	
-      case BOOT_TIME:
-	have_oldtime = 0;
-	memset(&delta, 0, sizeof(delta));
-	SET_TIMESPEC(duration, u);
-	DEBUF_PRINT_TIME("Boot time", *duration);
-	break;
-	
-      case OLD_TIME:
-	have_oldtime = 1;
-	SET_TIMESPEC(&oldtime, u);
-	DEBUF_PRINT_TIME("Old time", oldtime);
-	break;
-	
-      case NEW_TIME:
-	if (have_oldtime == 0)
-	  continue;
-	have_oldtime = 0;
-	SET_TIMESPEC(&newtime, u);
-	DEBUF_PRINT_TIME("New time", newtime);
-	newtime.tv_sec -= oldtime.tv_sec;
-	newtime.tv_nsec -= oldtime.tv_nsec;
-	ADJUST_NSEC(&newtime);
-	DEBUF_PRINT_TIME("New time - old time", newtime);
-	delta.tv_sec += newtime.tv_sec;
-	delta.tv_nsec += newtime.tv_nsec;
-	ADJUST_NSEC(&delta);
-	DEBUF_PRINT_TIME("Delta time", delta);
-	break;
-      default:
-	continue;
-      }
-  if ((errno != ESRCH) && (errno != ENOENT)) /* sic! */
-    goto fail;
+      __atomic_store_n((unsigned*)(sq + params.sq_off.tail), tail, __ATOMIC_RELEASE);
+      
+      /* Submit them all at once, and wait for all of them to complete. */
+      while ((submitted = URING_ENTER(ring, (unsigned)(k * 4), (unsigned)(k * 4))) < 0)
+	if (errno != EINTR)
+	  goto done;
+      
+      /* Reap the completions. The kernel stops submitting at the first
+       * entry it cannot prepare, and then does not wait, so only the
+       * submitted entries will complete. Those must be reaped before
+       * `probes` is freed, since they write to it. */
+      mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+      for (reaped = 0; reaped < (size_t)submitted;)
+	{
+	  head = *(unsigned*)(cq + params.cq_off.head);
+	  tail = __atomic_load_n((unsigned*)(cq + params.cq_off.tail), __ATOMIC_ACQUIRE);
+	  if (head == tail)
+	    {
+	      if ((URING_ENTER(ring, 0U, 1U) < 0) && (errno != EINTR))
+		goto done;
+	      continue;
+	    }
+	  for (; head != tail; head++, reaped++)
+	    {
+	      cqe = (struct io_uring_cqe*)(cq + params.cq_off.cqes) + (head & mask);
+	      probes[cqe->user_data / 4].res[cqe->user_data % 4] = cqe->res;
+	    }
+	  __atomic_store_n((unsigned*)(cq + params.cq_off.head), head, __ATOMIC_RELEASE);
+	}
+      if ((size_t)submitted < k * 4)
+	{
+	  errno = EAGAIN;
+	  goto done;
+	}
+      
+      /* Judge the logins. */
+      for (i = 0; i < k; i++)
+	{
+	  p = probes + i;
+	  if (p->res[0] == -EINVAL) /* IORING_OP_STATX is not supported. */
+	    goto done;
+	  if (p->res[0] || !S_ISCHR(p->attr[0].stx_mode))
+	    {
+	      verdict[off + i] = -1;
+	      continue;
+	    }
+	  for (j = 1; j < 4; j++)
+	    if (p->res[j] || !is_same_file(p->attr, p->attr + j))
+	      break;
+	  verdict[off + i] = (j == 4);
+	}
+    }
   
-  duration->tv_sec -= delta.tv_sec;
-  duration->tv_nsec -= delta.tv_nsec;
-  ADJUST_NSEC(duration);
-  DEBUF_PRINT_TIME("Last logout, delta-adjusted", *duration);
+  rc = 0;
+ done:
+  saved_errno = errno;
+  free(probes);
+  if (sqes != MAP_FAILED)  munmap(sqes, sqes_size);
+  if (cq   != MAP_FAILED)  munmap(cq,   cq_size);
+  if (sq   != MAP_FAILED)  munmap(sq,   sq_size);
+  close(ring);
+  errno = saved_errno;
+  return rc;
+#undef URING_ENTER
+}
+#endif
+
+
+/**
+ * Check whether a login is at one of the machine's seats, that is,
+ * on a console or virtual terminal, or on an X display, rather
+ * than remote or on a pseudo-terminal.
+ * 
+ * @param   u  The login record.
+ * @return     1 if it is a seat login, 0 otherwise.
+ */
+static int is_seat_login(const struct utmpx* u)
+{
+  if (!strncmp(u->ut_line, "pts/", sizeof("pts/") - 1))
+    return 0;
+  return !u->ut_host[0] || (u->ut_host[0] == ':');
+}
+
+
+/**
+ * Check which of a set of NORMAL_PROCESS records represent
+ * logins, and which of those are active. The method is
+ * selected by the environment variable AUTOHALTD_LIVENESS:
+ * "fd" (default), "stat", or, if built with io_uring(7),
+ * "uring", which is "fd" in batches.
+ * 
+ * @param  us       The login records.
+ * @param  n        The number of elements in `us`.
+ * @param  verdict  Output parameter for each record: -1 if it is not
+ *                  a login, 0 if it is an inactive login, and 1 if
+ *                  it is an active login.
+ */
+static void probe_logins(struct utmpx* us, size_t n, signed char* verdict)
+{
+  const char* liveness = getenv("AUTOHALTD_LIVENESS");
+  size_t i;
+  int active;
   
-  duration->tv_sec = now.tv_sec - duration->tv_sec;
-  duration->tv_nsec = now.tv_nsec - duration->tv_nsec;
-  ADJUST_NSEC(duration);
-  DEBUF_PRINT_TIME("Time since last logout", *duration);
+  if (liveness && !strcmp(liveness, "stat"))
+    {
+      for (i = 0; i < n; i++)
+	verdict[i] = (signed char)(is_login_by_stat(us + i, &active) ? active : -1);
+      return;
+    }
   
-  /* Update obsolete records. */
-  for (i = 0; i < obsolete_ptr; i++)
+#ifdef USE_IO_URING
+  if (liveness && !strcmp(liveness, "uring"))
     {
-      obsolete[i].ut_type = DEAD_PROCESS;
-#ifdef _HAVE_UT_TV
-      obsolete[i].ut_tv.tv_sec = (int32_t)(now.tv_sec);
-      obsolete[i].ut_tv.tv_usec = (int32_t)(now.tv_nsec / 1000L);
-#else
-      obsolete[i].ut_time = now.tv_sec;
+      if (!probe_logins_batched(us, n, verdict))
+	return;
+# ifdef DEBUG
+      perror("io_uring unavailable, probing logins serially");
+# endif
+    }
+#endif
+  
+  for (i = 0; i < n; i++)
+    verdict[i] = (signed char)(is_login(us + i, &active) ? active : -1);
+}
+
+
+/**
+ * The estimated cost of each stage of the decision, the
+ * stages are evaluated in ascending order of cost, and
+ * the evaluation stops at the first stage that vetoes
+ * the halt. Stages with equal costs are evaluated in the
+ * order they are listed in `stages`.
+ */
+#ifndef AUTOHALTD_COST_IDLE
+# define AUTOHALTD_COST_IDLE  10
+#endif
+#ifndef AUTOHALTD_COST_INHIBIT
+# define AUTOHALTD_COST_INHIBIT  15
+#endif
+#ifndef AUTOHALTD_COST_LIVENESS
+# define AUTOHALTD_COST_LIVENESS  20
+#endif
+#ifndef AUTOHALTD_COST_LOGIND
+# define AUTOHALTD_COST_LOGIND  30
+#endif
+#ifndef AUTOHALTD_COST_CONNECTIONS
+# define AUTOHALTD_COST_CONNECTIONS  40
+#endif
+
+
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+/**
+ * The state of a decision, shared between its stages.
+ * Each part is computed at most once, by the first
+ * stage that needs it, so the stages do not depend
+ * on the order they are evaluated in.
+ */
+struct pipeline
+{
+  /**
+   * The report of the decision.
+   */
+  struct check_report* report;
+  
+  /**
+   * The `seconds` parameter of `is_time_for_halt`.
+   */
+  unsigned long long int* seconds;
+  
+  /**
+   * The logins and logouts in utmp.
+   */
+  struct replay state;
+  
+  /**
+   * Whether `state` has been populated.
+   */
+  int scanned;
+  
+  /**
+   * The attributes of utmp, from before it was read.
+   */
+  struct stat utmp_attr;
+  
+  /**
+   * 1 if `utmp_attr` is set, -1 if utmp could not
+   * be stat:ed, 0 if it has not been tried yet.
+   */
+  int have_utmp_attr;
+  
+  /**
+   * For each login in `state`, -2 if it has not been
+   * probed, -1 if it is not a login, 0 if it is inactive,
+   * and 1 if it is active. `NULL` until the logins have
+   * been probed.
+   */
+  signed char* verdict;
+  
+  /**
+   * Whether the activity sources have been asked.
+   */
+  int asked;
+  
+  /**
+   * Whether any activity source knows whether the
+   * logged in users use the machine.
+   */
+  int known;
+  
+  /**
+   * Whether any activity source that knows whether the
+   * logged in users use the machine also sees the users
+   * that are logged in remotely, or on a pseudo-terminal.
+   * If only `known` is set, only seat logins are known.
+   */
+  int known_remote;
+  
+  /**
+   * The smallest idle time, in seconds, reported
+   * by any activity source.
+   */
+  unsigned long long int unused;
+};
+
+
+/**
+ * A stage in the decision.
+ */
+struct stage
+{
+  /**
+   * The name of the stage, used in debug output.
+   */
+  const char* name;
+  
+  /**
+   * The estimated cost of the stage.
+   */
+  int cost;
+  
+  /**
+   * The index of the stage in `report->stage_time`,
+   * one of the `CHECK_STAGE_*` constants.
+   */
+  int id;
+  
+  /**
+   * Evaluate the stage.
+   * 
+   * @param   p  The state of the decision.
+   * @return     1 if the stage permits the halt, 0 if it vetoes
+   *             the halt, having set `p->report->reason`, -1 on error.
+   */
+  int (*run)(struct pipeline* p);
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
 #endif
-      obsolete[i].ut_exit.e_termination = 0; /* Assume normal exit. But we have no idea. */
-      obsolete[i].ut_exit.e_exit = 0;
-      (void) pututxline(obsolete + i);
+
+
+/**
+ * Get the attributes of utmp, unless already done.
+ * 
+ * @param  p  The state of the decision.
+ */
+static void stat_utmp(struct pipeline* p)
+{
+  if (p->have_utmp_attr == 0)
+    p->have_utmp_attr = stat(clock_utmp(), &p->utmp_attr) ? -1 : 1;
+}
+
+
+/**
+ * Read all logins and logouts from utmp, unless already done.
+ * 
+ * @param   p  The state of the decision.
+ * @return     Zero on success, -1 on error.
+ */
+static int scan_utmp(struct pipeline* p)
+{
+  struct utmpx* u;
+  size_t records = 0;
+  int r, saved_errno;
+  
+  if (p->scanned)
+    return 0;
+  p->scanned = 1;
+  stat_utmp(p);
+  PROBE(scan_start);
+  
+  /* Whether a login is active is checked when all logins
+   * are known, so that all can be checked at once, and
+   * logins that are known to have ended are not checked
+   * at all. */
+  (void) clock_utmp();
+  setutxent();
+  errno = 0;
+  while ((u = getutxent()))
+    {
+      if ((r = replay_record(&p->state, u)) < 0)
+	goto fail;
+      PROBE3(utmp_record, u->ut_type, u->ut_pid, r);
+      records++;
     }
+  if (errno && (errno != ESRCH) && (errno != ENOENT)) /* sic! */
+    goto fail;
+  endutxent();
+  PROBE2(scan_end, records, p->state.nlogins);
+  return 0;
   
- done:
+ fail:
   saved_errno = errno;
   endutxent();
-  free(logins);
-  free(obsolete);
   errno = saved_errno;
-  return rc;
-  
- fail:
-  rc = -1;
-  goto done;
+  return -1;
 }
 
 
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
 /**
- * Return whether it is time to halt the machine.
+ * A source of activity that tells whether the logged in users
+ * use the machine.
+ */
+struct activity_source
+{
+  /**
+   * Returns 1 and the number of seconds since the source saw
+   * activity, or 0 if it is not configured or does not know,
+   * or -1 on error.
+   */
+  int (*get)(time_t now, unsigned long long int* idle);
+  
+  /**
+   * Whether the source only sees the users at the machine's
+   * seats, and thus cannot tell whether remote logins are used.
+   */
+  int seat_only;
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+/**
+ * Sources of activity that tell whether the logged in users use
+ * the machine.
+ */
+static const struct activity_source activity_sources[] = {
+  {get_cgroup_idle_time, 0},
+  {get_input_idle_time,  1},
+};
+
+
+/**
+ * Sources of activity that tell whether the machine is working
+ * for someone who is not logged in. Each returns 1 and the
+ * number of seconds since it saw activity, or 0 if it is not
+ * configured or does not know.
+ */
+static int (*const work_sources[])(time_t now, unsigned long long int* idle) = {
+  get_pressure_idle_time,
+  get_mounts_idle_time,
+};
+
+
+/**
+ * Ask the activity sources whether the logged in users use
+ * the machine, unless already done.
  * 
- * @param   seconds  The time, in seconds, that it is required that
- *                   the machine has been unused, before the machine
- *                   halts. If 0 is returned, it will be updated to
- *                   name the number of seconds in which it is
- *                   appropriate to check again.
- * @return           1 if it is time, 0 if it is not time, -1 on error.
+ * @param   p  The state of the decision.
+ * @return     Zero on success, -1 on error.
  */
-int is_time_for_halt(unsigned long long int* seconds)
+static int ask_activity_sources(struct pipeline* p)
 {
-  struct timespec duration;
+  unsigned long long int unused;
+  size_t i;
   int r;
   
-  /* How long ago was it that anyone logout? */
-  r = get_number_of_logins_and_last_logout(&duration);
+  if (p->asked)
+    return 0;
+  p->asked = 1;
+  
+  for (i = 0; i < sizeof(activity_sources) / sizeof(*activity_sources); i++)
+    {
+      r = activity_sources[i].get(p->report->time.tv_sec, &unused);
+      if (r < 0)
+	return -1;
+      if (r == 0)
+	continue;
+#ifdef DEBUG
+      fprintf(stderr, "No activity from source %zu for: %llus\n", i, unused);
+#endif
+      if (!p->known || (unused < p->unused))
+	p->unused = unused;
+      p->known = 1;
+      if (!activity_sources[i].seat_only)
+	p->known_remote = 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Add to the number of active logins in the report.
+ * 
+ * @param  p  The state of the decision.
+ * @param  n  The number of logins to add.
+ */
+static void add_logins(struct pipeline* p, int n)
+{
+  int* logins = &p->report->logins;
+  if (*logins < 0)
+    *logins = 0;
+  *logins = (*logins > INT_MAX - n) ? INT_MAX : (*logins + n);
+}
+
+
+/**
+ * Veto the halt if too little time has elapsed since
+ * the last logout, or since the logged in users last
+ * used the machine.
+ * 
+ * @param   p  The state of the decision.
+ * @return     1 if the stage permits the halt, 0 if it vetoes
+ *             the halt, -1 on error.
+ */
+static int stage_idle(struct pipeline* p)
+{
+  struct timespec duration, changed, history;
+  unsigned long long int* seconds = p->seconds;
+  unsigned long long int unused;
+  size_t i;
+  int r = 0, busy = 0;
+  
+  if (ask_activity_sources(p))
+    return -1;
+  
+  /* How long ago was it that anyone logout? Unless utmp has
+   * changed, the ledger knows without reading it. */
+  stat_utmp(p);
+  if (p->have_utmp_attr > 0)
+    r = get_ledger_idle_time(&p->utmp_attr, &duration);
+  if (r < 0)
+    return -1;
+  if (r == 0)
+    {
+      if (scan_utmp(p))
+	return -1;
+      replay_idle_time(&p->state, &p->report->time, &duration);
+      if ((p->have_utmp_attr > 0) && update_ledger(&p->utmp_attr, &p->state, &duration))
+	return -1;
+    }
+  DEBUF_PRINT_TIME(r ? "Time since last logout, from ledger" : "Time since last logout", duration);
+  
+  /* A logind session may have ended when the set of sessions changed. */
+  if (get_logind_change_time(&changed))
+    return -1;
+  if (changed.tv_sec)
+    {
+      changed.tv_sec = p->report->time.tv_sec - changed.tv_sec;
+      changed.tv_nsec = p->report->time.tv_nsec - changed.tv_nsec;
+      ADJUST_NSEC(&changed);
+      if (changed.tv_sec < 0)
+	memset(&changed, 0, sizeof(changed));
+      if ((changed.tv_sec < duration.tv_sec) ||
+	  ((changed.tv_sec == duration.tv_sec) && (changed.tv_nsec < duration.tv_nsec)))
+	duration = changed;
+      DEBUF_PRINT_TIME("Time since last session change", changed);
+    }
+  
+  /* pam_autohalt.so may have told of a session that utmp does not record. */
+  if (get_session_close_time(&changed))
+    return -1;
+  if (changed.tv_sec)
+    {
+      changed.tv_sec = p->report->time.tv_sec - changed.tv_sec;
+      changed.tv_nsec = p->report->time.tv_nsec;
+      ADJUST_NSEC(&changed);
+      if (changed.tv_sec < 0)
+	memset(&changed, 0, sizeof(changed));
+      if ((changed.tv_sec < duration.tv_sec) ||
+	  ((changed.tv_sec == duration.tv_sec) && (changed.tv_nsec < duration.tv_nsec)))
+	duration = changed;
+      DEBUF_PRINT_TIME("Time since last session close", changed);
+    }
+  
+  /* Logins that utmp does not know about, or has forgotten. */
+  r = get_history_idle_time(&p->report->time, &history);
   if (r < 0)
     return -1;
+  if (r)
+    {
+      if (history.tv_sec < 0)
+	memset(&history, 0, sizeof(history));
+      if ((history.tv_sec < duration.tv_sec) ||
+	  ((history.tv_sec == duration.tv_sec) && (history.tv_nsec < duration.tv_nsec)))
+	duration = history;
+      DEBUF_PRINT_TIME("Time since last activity in wtmp or lastlog", history);
+    }
+  
+  /* Is the machine working for someone who is not logged in? */
+  for (i = 0; i < sizeof(work_sources) / sizeof(*work_sources); i++)
+    {
+      if (!work_sources[i](p->report->time.tv_sec, &unused))
+	continue;
+#ifdef DEBUG
+      fprintf(stderr, "No work from source %zu for: %llus\n", i, unused);
+#endif
+      if (unused < (unsigned long long int)(duration.tv_sec))
+	{
+	  duration.tv_sec = (time_t)unused;
+	  duration.tv_nsec = 0;
+	  busy = 1;
+	}
+    }
+  
+  /* Are the logged in users doing anything? */
+  if (p->known && (p->unused < (unsigned long long int)(duration.tv_sec)))
+    {
+      duration.tv_sec = (time_t)(p->unused);
+      duration.tv_nsec = 0;
+      busy = 1;
+    }
+  
+  p->report->idle = (unsigned long long int)(duration.tv_sec);
 #ifdef DEBUG
   fprintf(stderr, "Required idle time: %lli.%09lis\n", *seconds, 0L);
   fprintf(stderr, "Current idle time:  %lli.%09lis\n",
@@ -322,22 +897,291 @@ int is_time_for_halt(unsigned long long int* seconds)
   if ((unsigned long long int)(duration.tv_sec) < *seconds)
     {
       *seconds -= (unsigned long long int)(duration.tv_sec);
+      p->report->reason = busy ? REASON_BUSY : REASON_RECENT_LOGOUT;
 #ifdef DEBUG
       fprintf(stderr, "Check again in:     %lli.%09lis\n", *seconds, 0L);
 #endif
       return 0;
     }
-  /* Has everyone logged out? */
+  return 1;
+}
+
+
+/**
+ * Veto the halt if anyone is logged in according to utmp, unless
+ * an activity source knows whether the logins are used. The input
+ * devices only tell whether seat logins are used, so other logins
+ * are still counted when they are the only source. Records of
+ * logins that have ended are marked as dead.
+ * 
+ * Only logins that no logout in utmp has ended are probed, newest
+ * first, since they are most likely to still be active, in chunks
+ * that double in size, and probing stops after the first chunk with
+ * an active login, since one is enough for the veto.
+ * 
+ * @param   p  The state of the decision.
+ * @return     1 if the stage permits the halt, 0 if it vetoes
+ *             the halt, -1 on error.
+ */
+static int stage_liveness(struct pipeline* p)
+{
+  struct utmpx* logins;
+  size_t i, n, end, chunk;
+  int rc = 0;
+  
+  if (scan_utmp(p) || ask_activity_sources(p))
+    return -1;
+  if (p->known_remote)
+    return 1; /* Logins that are not used do not keep the machine up. */
+  
+  logins = p->state.logins;
+  n = p->state.nlogins;
+  p->verdict = malloc((n ? n : 1) * sizeof(*(p->verdict)));
+  if (p->verdict == NULL)
+    return -1;
+  memset(p->verdict, -2, n * sizeof(*(p->verdict)));
+  
+  setutxent();
+  for (end = n, chunk = 1; (rc == 0) && end; end -= chunk, chunk <<= 1)
+    {
+      /* Which logins are active? */
+      if (chunk > end)
+	chunk = end;
+      probe_logins(logins + end - chunk, chunk, p->verdict + end - chunk);
+      
+      for (i = end - chunk; i < end; i++)
+	{
+	  PROBE3(login_verdict, logins[i].ut_pid, logins[i].ut_line, p->verdict[i]);
 #ifdef DEBUG
-  fprintf(stderr, "Number of active logins: %i\n", r);
+	  fprintf(stderr, "Login: pid=%ji, line=%s, login=%s, active=%s\n",
+		  (intmax_t)(logins[i].ut_pid), logins[i].ut_line,
+		  (p->verdict[i] < 0 ? "no" : "yes"), (p->verdict[i] > 0 ? "yes" : "no"));
 #endif
-  if (r > 0)
-    return 0;
+	  if (p->verdict[i] > 0)
+	    {
+	      /* The input tells whether seat logins are used. */
+	      if (p->known && is_seat_login(logins + i))
+		continue;
+	      if (rc < INT_MAX)
+		rc++;
+	    }
+	  else if (p->verdict[i] == 0)
+	    {
+	      /* Update obsolete record. */
+	      logins[i].ut_type = DEAD_PROCESS;
+#ifdef _HAVE_UT_TV
+	      logins[i].ut_tv.tv_sec = (int32_t)(p->report->time.tv_sec);
+	      logins[i].ut_tv.tv_usec = (int32_t)(p->report->time.tv_nsec / 1000L);
+#else
+	      logins[i].ut_time = p->report->time.tv_sec;
+#endif
+	      logins[i].ut_exit.e_termination = 0; /* Assume normal exit. But we have no idea. */
+	      logins[i].ut_exit.e_exit = 0;
+	      (void) pututxline(logins + i);
+	    }
+	}
+    }
+  endutxent();
   
+  add_logins(p, rc);
+#ifdef DEBUG
+  fprintf(stderr, "Number of active logins in utmp: %i (%zu of %zu probed)\n", rc, n - end, n);
+#endif
+  if (rc > 0)
+    {
+      p->report->reason = REASON_LOGGED_IN;
+      return 0;
+    }
   return 1;
 }
 
 
+/**
+ * Veto the halt if anyone is logged in according to
+ * systemd-logind(8), unless an activity source knows
+ * whether the logins are used. If it only knows whether
+ * seat logins are used, only the other sessions are counted.
+ * 
+ * @param   p  The state of the decision.
+ * @return     1 if the stage permits the halt, 0 if it vetoes
+ *             the halt, -1 on error.
+ */
+static int stage_logind(struct pipeline* p)
+{
+  int r;
+  
+  if (ask_activity_sources(p))
+    return -1;
+  if (p->known_remote)
+    return 1;
+  
+  /* Which logins did not make it into utmp? Sessions
+   * that are already counted can only be recognised
+   * if the utmp logins have been probed. */
+  r = count_logind_sessions(p->state.logins, p->verdict, p->verdict ? p->state.nlogins : 0, p->known);
+  if (r < 0)
+    return -1;
+  add_logins(p, r);
+#ifdef DEBUG
+  fprintf(stderr, "Number of other logind sessions: %i\n", r);
+#endif
+  if (r > 0)
+    {
+      p->report->reason = REASON_LOGGED_IN;
+      return 0;
+    }
+  return 1;
+}
+
+
+/**
+ * Veto the halt if any watched connection is established.
+ * 
+ * @param   p  The state of the decision.
+ * @return     1 if the stage permits the halt, 0 if it vetoes
+ *             the halt, -1 on error.
+ */
+static int stage_connections(struct pipeline* p)
+{
+  int r = have_connections();
+  if (r < 0)
+    return -1;
+#ifdef DEBUG
+  fprintf(stderr, "Watched connections established: %s\n", r ? "yes" : "no");
+#endif
+  if (r > 0)
+    {
+      p->report->reason = REASON_CONNECTED;
+      return 0;
+    }
+  return 1;
+}
+
+
+/**
+ * Veto the halt if any process holds a lock in the
+ * inhibitor directory. Unlike a login, the lock does
+ * not postpone the halt once it is released.
+ * 
+ * @param   p  The state of the decision.
+ * @return     1 if the stage permits the halt, 0 if it vetoes
+ *             the halt, -1 on error.
+ */
+static int stage_inhibit(struct pipeline* p)
+{
+  int r = count_inhibitors();
+  if (r < 0)
+    return -1;
+#ifdef DEBUG
+  fprintf(stderr, "Number of inhibitors: %i\n", r);
+#endif
+  if (r > 0)
+    {
+      p->report->reason = REASON_INHIBITED;
+      return 0;
+    }
+  return 1;
+}
+
+
+/**
+ * The stages of the decision, sorted by cost
+ * the first time `is_time_for_halt` is called.
+ */
+static struct stage stages[CHECK_STAGES] = {
+  {"idle",        AUTOHALTD_COST_IDLE,        CHECK_STAGE_IDLE,        stage_idle},
+  {"liveness",    AUTOHALTD_COST_LIVENESS,    CHECK_STAGE_LIVENESS,    stage_liveness},
+  {"logind",      AUTOHALTD_COST_LOGIND,      CHECK_STAGE_LOGIND,      stage_logind},
+  {"connections", AUTOHALTD_COST_CONNECTIONS, CHECK_STAGE_CONNECTIONS, stage_connections},
+  {"inhibit",     AUTOHALTD_COST_INHIBIT,     CHECK_STAGE_INHIBIT,     stage_inhibit},
+};
+
+
+/**
+ * Compare two stages by cost, and by their
+ * listed order if the costs are equal.
+ * 
+ * @param   a  One of the stages.
+ * @param   b  The other stage.
+ * @return     Negative if `a` is evaluated first, positive otherwise.
+ */
+static int stagecmp(const void* a, const void* b)
+{
+  const struct stage* x = a;
+  const struct stage* y = b;
+  if (x->cost != y->cost)
+    return x->cost < y->cost ? -1 : 1;
+  return x->id - y->id;
+}
+
+
+/**
+ * Return whether it is time to halt the machine.
+ * 
+ * @param   seconds  The time, in seconds, that it is required that
+ *                   the machine has been unused, before the machine
+ *                   halts. If 0 is returned, it will be updated to
+ *                   name the number of seconds in which it is
+ *                   appropriate to check again.
+ * @param   report   Output parameter for details about the decision.
+ * @return           1 if it is time, 0 if it is not time, -1 on error.
+ */
+int is_time_for_halt(unsigned long long int* seconds, struct check_report* report)
+{
+  static int sorted = 0;
+  struct pipeline p;
+  struct timespec start, end;
+  size_t i;
+  int r = 1, saved_errno;
+  
+  memset(report, 0, sizeof(*report));
+  report->logins = -1;
+  report->reason = REASON_ERROR;
+  if (clock_now(CLOCK_REALTIME, &report->time))
+    return -1;
+  DEBUF_PRINT_TIME("Current time", report->time);
+  
+  if (!sorted)
+    {
+      qsort(stages, sizeof(stages) / sizeof(*stages), sizeof(*stages), stagecmp);
+      sorted = 1;
+    }
+  
+  memset(&p, 0, sizeof(p));
+  p.report = report;
+  p.seconds = seconds;
+  replay_init(&p.state, &report->time);
+  PROBE(check_start);
+  
+  for (i = 0; (r > 0) && (i < sizeof(stages) / sizeof(*stages)); i++)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      r = stages[i].run(&p);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      end.tv_sec -= start.tv_sec;
+      end.tv_nsec -= start.tv_nsec;
+      ADJUST_NSEC(&end);
+      report->stage_time[stages[i].id] =
+	(unsigned long long int)(end.tv_sec) * 1000000000ULL + (unsigned long long int)(end.tv_nsec);
+      report->stages |= 1 << stages[i].id;
+      PROBE3(stage, stages[i].id, r, report->stage_time[stages[i].id]);
+#ifdef DEBUG
+      fprintf(stderr, "Stage %s: %s in %lluns\n", stages[i].name,
+	      r < 0 ? "failed" : r ? "passed" : "vetoed", report->stage_time[stages[i].id]);
+#endif
+    }
+  
+  if (r > 0)
+    report->reason = REASON_HALT;
+  PROBE3(check_end, r, *seconds, report->reason);
+  saved_errno = errno;
+  replay_destroy(&p.state);
+  free(p.verdict);
+  errno = saved_errno;
+  return r;
+}
+
+
 /**
  * Halt the machine.
  * 
@@ -366,6 +1210,36 @@ void halt(int argc, char* argv[])
 # pragma GCC diagnostic pop
 #endif
   
+  PROBE(halt);
   execvp(SHUTDOWN_FILENAME, args);
 }
 
+
+/**
+ * Suspend the machine.
+ * 
+ * This function returns when the machine resumes.
+ * 
+ * @param   state  The sleep state to enter, "mem" to
+ *                 suspend to RAM, or "disk" to suspend
+ *                 to disk.
+ * @return         Zero on success, -1 on error.
+ */
+int suspend_machine(const char* state)
+{
+  size_t len = strlen(state);
+  ssize_t r;
+  int fd, saved_errno;
+  
+  fd = open(AUTOHALTD_POWER_STATE_PATHNAME, O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  /* Blocks until the machine resumes. */
+  PROBE1(suspend, state);
+  r = write(fd, state, len);
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return ((size_t)r == len) ? 0 : -1;
+}
+
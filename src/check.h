@@ -16,6 +16,156 @@
  */
 
 
+#include <time.h>
+
+
+
+/**
+ * It is time to halt the machine.
+ */
+#define REASON_HALT  0
+
+/**
+ * It is not time to halt the machine, because
+ * too little time has elapsed since the last logout.
+ */
+#define REASON_RECENT_LOGOUT  1
+
+/**
+ * It is not time to halt the machine, because
+ * someone is logged in.
+ */
+#define REASON_LOGGED_IN  2
+
+/**
+ * The check failed.
+ */
+#define REASON_ERROR  3
+
+/**
+ * It is time to suspend the machine to RAM.
+ */
+#define REASON_SUSPEND  4
+
+/**
+ * It is time to suspend the machine to disk.
+ */
+#define REASON_HIBERNATE  5
+
+/**
+ * It is not time to halt the machine, because
+ * a watched connection is established.
+ */
+#define REASON_CONNECTED  6
+
+/**
+ * It is not time to halt the machine, because the
+ * monitored cgroups were in use too recently.
+ */
+#define REASON_BUSY  7
+
+/**
+ * It is not time to halt the machine, because a
+ * process holds a lock in the inhibitor directory.
+ */
+#define REASON_INHIBITED  8
+
+/**
+ * It is not time to halt the machine, and the idle
+ * action that is due has already been taken, the
+ * machine resumed without being used.
+ */
+#define REASON_TIER_TAKEN  9
+
+
+
+/**
+ * The stage of the decision that checks whether enough
+ * time has elapsed since the last logout, and since the
+ * logged in users last used the machine.
+ */
+#define CHECK_STAGE_IDLE  0
+
+/**
+ * The stage of the decision that checks whether the
+ * logins in utmp are active.
+ */
+#define CHECK_STAGE_LIVENESS  1
+
+/**
+ * The stage of the decision that counts the sessions
+ * systemd-logind(8) knows about.
+ */
+#define CHECK_STAGE_LOGIND  2
+
+/**
+ * The stage of the decision that checks for
+ * watched connections.
+ */
+#define CHECK_STAGE_CONNECTIONS  3
+
+/**
+ * The stage of the decision that checks for
+ * locks in the inhibitor directory.
+ */
+#define CHECK_STAGE_INHIBIT  4
+
+/**
+ * The number of stages in the decision.
+ */
+#define CHECK_STAGES  5
+
+
+
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+/**
+ * Details about a decision made by `is_time_for_halt`.
+ */
+struct check_report
+{
+  /**
+   * When the decision was made.
+   */
+  struct timespec time;
+  
+  /**
+   * The number of seconds since the last logout.
+   */
+  unsigned long long int idle;
+  
+  /**
+   * The time, in nanoseconds, each stage of the decision
+   * took, indexed by the `CHECK_STAGE_*` constants.
+   */
+  unsigned long long int stage_time[CHECK_STAGES];
+  
+  /**
+   * The number of active logins, -1 if unknown. Counting
+   * stops at the first stage that finds any, so this is a
+   * lower bound.
+   */
+  int logins;
+  
+  /**
+   * Why the decision was made, one of the `REASON_*` constants.
+   */
+  int reason;
+  
+  /**
+   * Bitmask of the stages that were evaluated, bit `1 << x`
+   * is set if the stage `CHECK_STAGE_x` was evaluated.
+   */
+  int stages;
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
 /**
  * Return whether it is time to halt the machine.
  * 
@@ -24,9 +174,10 @@
  *                   halts. If 0 is returned, it will be updated to
  *                   name the number of seconds in which it is
  *                   appropriate to check again.
+ * @param   report   Output parameter for details about the decision.
  * @return           1 if it is time, 0 if it is not time, -1 on error.
  */
-int is_time_for_halt(unsigned long long int* seconds);
+int is_time_for_halt(unsigned long long int* seconds, struct check_report* report);
 
 
 /**
@@ -41,3 +192,15 @@ int is_time_for_halt(unsigned long long int* seconds);
  */
 void halt(int argc, char* argv[]);
 
+/**
+ * Suspend the machine.
+ * 
+ * This function returns when the machine resumes.
+ * 
+ * @param   state  The sleep state to enter, "mem" to
+ *                 suspend to RAM, or "disk" to suspend
+ *                 to disk.
+ * @return         Zero on success, -1 on error.
+ */
+int suspend_machine(const char* state);
+
@@ -0,0 +1,182 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <utmpx.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+
+
+/**
+ * Read the fake clock.
+ * 
+ * @param   path  The pathname of the fake clock.
+ * @param   real  Output parameter for the real time.
+ * @param   boot  Output parameter for the boot time.
+ * @return        Zero on success, -1 on error.
+ */
+static int read_clock(const char* path, long long int* real, long long int* boot)
+{
+  FILE* f = fopen(path, "r");
+  int r;
+  if (f == NULL)
+    return -1;
+  r = fscanf(f, "%lli %lli", real, boot);
+  fclose(f);
+  if (r != 2)
+    return errno = EINVAL, -1;
+  return 0;
+}
+
+
+/**
+ * Advance the fake clock, and run the hook.
+ * 
+ * @param   path     The pathname of the fake clock.
+ * @param   seconds  The number of seconds to advance it.
+ * @return           Zero on success, -1 on error.
+ */
+static int advance_clock(const char* path, long long int seconds)
+{
+  const char* hook = getenv("AUTOHALTD_FAKE_CLOCK_HOOK");
+  char old[3 * sizeof(long long int) + 2], new[3 * sizeof(long long int) + 2];
+  long long int real, boot;
+  FILE* f;
+  pid_t pid;
+  int status;
+  
+  if (read_clock(path, &real, &boot))
+    return -1;
+  f = fopen(path, "w");
+  if (f == NULL)
+    return -1;
+  fprintf(f, "%lli %lli\n", real + seconds, boot + seconds);
+  if (fclose(f))
+    return -1;
+  
+  if ((hook == NULL) || (*hook == '\0'))
+    return 0;
+  sprintf(old, "%lli", real);
+  sprintf(new, "%lli", real + seconds);
+  pid = fork();
+  if (pid == -1)
+    return -1;
+  if (pid == 0)
+    {
+      execl(hook, hook, old, new, NULL);
+      perror(hook);
+      _exit(1);
+    }
+  while (waitpid(pid, &status, 0) == -1)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+
+/**
+ * Get the time of a clock, as by clock_gettime(3).
+ * 
+ * @param   clk  The clock.
+ * @param   ts   Output parameter for the time.
+ * @return       Zero on success, -1 on error.
+ */
+int clock_now(clockid_t clk, struct timespec* ts)
+{
+  const char* path = getenv("AUTOHALTD_FAKE_CLOCK");
+  long long int real, boot;
+  
+  if ((path == NULL) || (*path == '\0'))
+    return clock_gettime(clk, ts);
+  if (read_clock(path, &real, &boot))
+    return -1;
+  ts->tv_sec = (time_t)(clk == CLOCK_REALTIME ? real : boot);
+  ts->tv_nsec = 0;
+  return 0;
+}
+
+
+/**
+ * Sleep, as by sleep(3).
+ * 
+ * @param   seconds  The number of seconds to sleep.
+ * @return           The number of seconds left, if interrupted.
+ */
+unsigned int clock_sleep(unsigned int seconds)
+{
+  const char* path = getenv("AUTOHALTD_FAKE_CLOCK");
+  
+  if ((path == NULL) || (*path == '\0'))
+    return sleep(seconds);
+  if (advance_clock(path, (long long int)seconds))
+    perror("autohaltd");
+  return 0;
+}
+
+
+/**
+ * Wait for events, as by epoll_wait(2). With a fake clock,
+ * the clock is advanced by the timeout, if nothing is ready.
+ * 
+ * @param   epfd     The epoll(7) instance.
+ * @param   events   Output parameter for the events.
+ * @param   max      The maximum number of events to return.
+ * @param   timeout  The timeout in milliseconds, -1 for none.
+ * @return           The number of events, -1 on error.
+ */
+int clock_epoll_wait(int epfd, struct epoll_event* events, int max, int timeout)
+{
+  const char* path = getenv("AUTOHALTD_FAKE_CLOCK");
+  int n;
+  
+  if ((path == NULL) || (*path == '\0'))
+    return epoll_wait(epfd, events, max, timeout);
+  
+  /* Events caused by the hook are reported at the time the hook ran. */
+  n = epoll_wait(epfd, events, max, 0);
+  if (n != 0)
+    return n;
+  if (timeout < 0)
+    return epoll_wait(epfd, events, max, timeout);
+  if (advance_clock(path, (long long int)((timeout + 999) / 1000)))
+    return -1;
+  return epoll_wait(epfd, events, max, 0);
+}
+
+
+/**
+ * Select the utmp file, named by the environment
+ * variable AUTOHALTD_FAKE_UTMP, if set.
+ * 
+ * @return  The pathname of the utmp file.
+ */
+const char* clock_utmp(void)
+{
+  const char* path = getenv("AUTOHALTD_FAKE_UTMP");
+  if ((path == NULL) || (*path == '\0'))
+    return UTMPX_FILE;
+  utmpxname(path);
+  return path;
+}
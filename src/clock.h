@@ -0,0 +1,96 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct epoll_event;
+
+
+
+/*
+ * When built with test hooks (./configure --with-test-hooks),
+ * the clock, sleeping, and utmp can be virtualised through the
+ * environment, so that days of the sleep → check cycle can run
+ * in seconds:
+ * 
+ *   AUTOHALTD_FAKE_CLOCK       Pathname of a file with the current
+ *                              time, as "REALTIME BOOTTIME", in
+ *                              seconds. CLOCK_MONOTONIC reads as
+ *                              CLOCK_BOOTTIME. Sleeping advances
+ *                              both at once, instead of waiting.
+ *                              Edit the first number to step the
+ *                              wall-clock.
+ * 
+ *   AUTOHALTD_FAKE_CLOCK_HOOK  Program to run, and wait for, each
+ *                              time the clock is advanced, with the
+ *                              old and the new real time as its
+ *                              arguments. It can script logins,
+ *                              logouts, clock changes, and SIGHUP:s.
+ * 
+ *   AUTOHALTD_FAKE_UTMP        Pathname of the utmp file to use.
+ * 
+ * Without test hooks, these are the real functions.
+ */
+#ifdef USE_TEST_HOOKS
+
+
+/**
+ * Get the time of a clock, as by clock_gettime(3).
+ * 
+ * @param   clk  The clock.
+ * @param   ts   Output parameter for the time.
+ * @return       Zero on success, -1 on error.
+ */
+int clock_now(clockid_t clk, struct timespec* ts);
+
+/**
+ * Sleep, as by sleep(3).
+ * 
+ * @param   seconds  The number of seconds to sleep.
+ * @return           The number of seconds left, if interrupted.
+ */
+unsigned int clock_sleep(unsigned int seconds);
+
+/**
+ * Wait for events, as by epoll_wait(2). With a fake clock,
+ * the clock is advanced by the timeout, if nothing is ready.
+ * 
+ * @param   epfd     The epoll(7) instance.
+ * @param   events   Output parameter for the events.
+ * @param   max      The maximum number of events to return.
+ * @param   timeout  The timeout in milliseconds, -1 for none.
+ * @return           The number of events, -1 on error.
+ */
+int clock_epoll_wait(int epfd, struct epoll_event* events, int max, int timeout);
+
+/**
+ * Select the utmp file, named by the environment
+ * variable AUTOHALTD_FAKE_UTMP, if set.
+ * 
+ * @return  The pathname of the utmp file.
+ */
+const char* clock_utmp(void);
+
+
+#else
+
+# define clock_now         clock_gettime
+# define clock_sleep       sleep
+# define clock_epoll_wait  epoll_wait
+# define clock_utmp()      (UTMPX_FILE)
+
+#endif
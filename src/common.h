@@ -49,6 +49,17 @@
 # define SHUTDOWN_FILENAME  "echo"
 #endif
 
+/**
+ * The pathname of the file used to suspend the machine.
+ */
+#ifndef DEBUG
+# ifndef AUTOHALTD_POWER_STATE_PATHNAME
+#  define AUTOHALTD_POWER_STATE_PATHNAME  SYSDIR "/power/state"
+# endif
+#else
+# define AUTOHALTD_POWER_STATE_PATHNAME  DEVDIR "/stderr"
+#endif
+
 /**
  * The default interval.
  */
@@ -56,3 +67,238 @@
 # define AUTOHALTD_DEFAULT_INTERVAL  (1 * 60 * 60)  /* 1 hour */
 #endif
 
+/**
+ * The pathname of the flight recorder, where
+ * decisions about halting are stored.
+ */
+#ifndef AUTOHALTD_TRACE_PATHNAME
+# define AUTOHALTD_TRACE_PATHNAME  RUNDIR "/autohaltd.trace"
+#endif
+
+/**
+ * The number of decisions the flight recorder can hold.
+ */
+#ifndef AUTOHALTD_TRACE_RECORDS
+# define AUTOHALTD_TRACE_RECORDS  1024
+#endif
+
+/**
+ * The directory of the real-time clock used to
+ * wake the machine, in sysfs.
+ */
+#ifndef AUTOHALTD_RTC_DIRECTORY
+# define AUTOHALTD_RTC_DIRECTORY  SYSDIR "/class/rtc/rtc0"
+#endif
+
+/**
+ * The least number of seconds between halting and
+ * waking the machine, to let the shutdown complete.
+ */
+#ifndef AUTOHALTD_WAKE_MARGIN
+# define AUTOHALTD_WAKE_MARGIN  (5 * 60)  /* 5 minutes */
+#endif
+
+/**
+ * The number of seconds the start of an idle period may
+ * move, between two checks, without being considered to
+ * be a new idle period, after an idle action has been
+ * taken. It may move because of rounding and clock skew.
+ */
+#ifndef AUTOHALTD_TIER_SLACK
+# define AUTOHALTD_TIER_SLACK  60
+#endif
+
+
+/**
+ * The directory where systemd-logind(8) stores
+ * the state of each session.
+ */
+#ifndef AUTOHALTD_LOGIND_DIRECTORY
+# define AUTOHALTD_LOGIND_DIRECTORY  RUNDIR "/systemd/sessions"
+#endif
+
+/**
+ * The directory where the cgroup v2 hierarchy is mounted.
+ * Relative cgroup pathnames are resolved from here.
+ */
+#ifndef AUTOHALTD_CGROUP_DIRECTORY
+# define AUTOHALTD_CGROUP_DIRECTORY  SYSDIR "/fs/cgroup"
+#endif
+
+/**
+ * The default CPU usage, in percent of one CPU, at
+ * and above which monitored cgroups are in use.
+ */
+#ifndef AUTOHALTD_CGROUP_CPU_THRESHOLD
+# define AUTOHALTD_CGROUP_CPU_THRESHOLD  1
+#endif
+
+/**
+ * The default I/O throughput, in bytes per second, at
+ * and above which monitored cgroups are in use.
+ */
+#ifndef AUTOHALTD_CGROUP_IO_THRESHOLD
+# define AUTOHALTD_CGROUP_IO_THRESHOLD  (64 << 10)  /* 64 KiB/s */
+#endif
+
+/**
+ * The default pathname of the socket of autohaltd-coord.
+ */
+#ifndef AUTOHALTD_COORD_PATHNAME
+# define AUTOHALTD_COORD_PATHNAME  RUNDIR "/autohaltd-coord.socket"
+#endif
+
+/**
+ * The number of seconds to wait for autohaltd-coord
+ * to grant a halt, before halting anyway.
+ */
+#ifndef AUTOHALTD_COORD_TIMEOUT
+# define AUTOHALTD_COORD_TIMEOUT  (15 * 60)  /* 15 minutes */
+#endif
+
+/**
+ * The default number of machines autohaltd-coord
+ * lets halt at the same time.
+ */
+#ifndef AUTOHALTD_COORD_SLOTS
+# define AUTOHALTD_COORD_SLOTS  2
+#endif
+
+/**
+ * The default largest number of seconds autohaltd-coord
+ * randomly delays a halt that had to wait for its turn.
+ */
+#ifndef AUTOHALTD_COORD_JITTER
+# define AUTOHALTD_COORD_JITTER  10
+#endif
+
+/**
+ * The default least number of seconds autohaltd-coord
+ * considers a halt to be in progress after granting it.
+ */
+#ifndef AUTOHALTD_COORD_HOLD
+# define AUTOHALTD_COORD_HOLD  30
+#endif
+
+/**
+ * Normalise the nanoseconds of a `struct timespec`
+ * after adding or subtracting another one.
+ */
+#define ADJUST_NSEC(ts)						\
+  do								\
+    {								\
+      if ((ts)->tv_nsec > 1000000000L)				\
+	(ts)->tv_nsec -= 1000000000L, (ts)->tv_sec += 1;	\
+      else if ((ts)->tv_nsec < 0L)				\
+	(ts)->tv_nsec += 1000000000L, (ts)->tv_sec -= 1;	\
+    }								\
+  while (0)
+
+/**
+ * Print a `struct timespec`, with a label, if this is a debug build.
+ */
+#ifdef DEBUG
+# define DEBUF_PRINT_TIME(label, ts)				\
+  fprintf(stderr, "%s: %lli.%09lis\n", label, (unsigned long long int)((ts).tv_sec), (ts).tv_nsec)
+#else
+# define DEBUF_PRINT_TIME(label, ts)  /* Do nothing. */
+#endif
+
+/**
+ * The directory with the input devices.
+ */
+#ifndef AUTOHALTD_INPUT_DIRECTORY
+# define AUTOHALTD_INPUT_DIRECTORY  DEVDIR "/input"
+#endif
+
+/**
+ * The number of seconds input devices are left unwatched
+ * after input, so that continuous input does not wake
+ * the sleep image more than once in this time.
+ */
+#ifndef AUTOHALTD_INPUT_COALESCE
+# define AUTOHALTD_INPUT_COALESCE  30
+#endif
+
+/**
+ * The directory where processes that shall keep the
+ * machine up hold a flock(2) on a file of their own.
+ */
+#ifndef AUTOHALTD_INHIBIT_DIRECTORY
+# define AUTOHALTD_INHIBIT_DIRECTORY  RUNDIR "/autohaltd.inhibit"
+#endif
+
+/**
+ * The default pathname of wtmp, for --wtmp.
+ */
+#ifndef AUTOHALTD_WTMP_PATHNAME
+# define AUTOHALTD_WTMP_PATHNAME  LOGDIR "/wtmp"
+#endif
+
+/**
+ * The default pathname of lastlog, for --lastlog.
+ */
+#ifndef AUTOHALTD_LASTLOG_PATHNAME
+# define AUTOHALTD_LASTLOG_PATHNAME  LOGDIR "/lastlog"
+#endif
+
+/**
+ * The pathname of the socket pam_autohalt.so notifies
+ * autohaltd on when sessions are opened and closed.
+ */
+#ifndef AUTOHALTD_NOTIFY_PATHNAME
+# define AUTOHALTD_NOTIFY_PATHNAME  RUNDIR "/autohaltd.notify"
+#endif
+
+/**
+ * The number of seconds to wait, after the last session
+ * was closed, before checking whether to halt, so that
+ * the logout has been recorded.
+ */
+#ifndef AUTOHALTD_NOTIFY_SETTLE
+# define AUTOHALTD_NOTIFY_SETTLE  2
+#endif
+
+/**
+ * The directory with the pressure stall information
+ * files, for --pressure.
+ */
+#ifndef AUTOHALTD_PRESSURE_DIRECTORY
+# define AUTOHALTD_PRESSURE_DIRECTORY  PROCDIR "/pressure"
+#endif
+
+/**
+ * The pressure that counts as activity: the number of
+ * microseconds some task must have stalled on the resource
+ * within a window of `AUTOHALTD_PRESSURE_WINDOW` microseconds.
+ */
+#ifndef AUTOHALTD_PRESSURE_STALL
+# define AUTOHALTD_PRESSURE_STALL  200000
+#endif
+
+/**
+ * The window, in microseconds, in which pressure is measured,
+ * 500000 to 10000000, and a multiple of 2000000 for
+ * unprivileged users.
+ */
+#ifndef AUTOHALTD_PRESSURE_WINDOW
+# define AUTOHALTD_PRESSURE_WINDOW  2000000
+#endif
+
+/**
+ * The number of seconds the pressure triggers are left
+ * unwatched after they fire, so that continuous pressure
+ * does not wake the sleep image more than once in this time.
+ */
+#ifndef AUTOHALTD_PRESSURE_COALESCE
+# define AUTOHALTD_PRESSURE_COALESCE  30
+#endif
+
+/**
+ * The number of seconds the mounts in --mounts are left
+ * unwatched after a write, so that continuous writes do
+ * not wake the sleep image more than once in this time.
+ */
+#ifndef AUTOHALTD_MOUNTS_COALESCE
+# define AUTOHALTD_MOUNTS_COALESCE  30
+#endif
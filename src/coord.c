@@ -0,0 +1,97 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "coord.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+
+/**
+ * Ask autohaltd-coord, on the socket named by the environment
+ * variable AUTOHALTD_COORD, for a turn to halt the machine, and
+ * wait until it is granted. The turn lasts until the returned
+ * file descriptor is closed; it is not closed on exec, so that
+ * shutdown(8) holds it.
+ * 
+ * If the coordinator cannot be reached, or does not answer in
+ * `AUTOHALTD_COORD_TIMEOUT` seconds, the machine should halt
+ * anyway: a broken coordinator must not keep machines up.
+ * 
+ * @param   waited  Output parameter for whether the machine had
+ *                  to wait for its turn, in which case it may have
+ *                  been used meanwhile, and should be checked again.
+ * @return          A file descriptor that holds the turn, -1 if the
+ *                  halt is not coordinated, with `errno` set to zero
+ *                  if AUTOHALTD_COORD is not set.
+ */
+int acquire_halt_slot(int* waited)
+{
+  const char* path = getenv("AUTOHALTD_COORD");
+  struct sockaddr_un addr;
+  struct pollfd pfd;
+  char grant;
+  int fd, r;
+  
+  if ((path == NULL) || (*path == '\0'))
+    return errno = 0, -1;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return errno = ENAMETOOLONG, -1;
+  
+  fd = socket(PF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(fd, (void*)&addr, (socklen_t)sizeof(addr)))
+    goto fail;
+  
+  /* The coordinator writes a byte when it is our turn,
+   * non-zero if we were not given the turn at once. */
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while ((r = poll(&pfd, (nfds_t)1, AUTOHALTD_COORD_TIMEOUT * 1000)) < 0)
+    if (errno != EINTR)
+      goto fail;
+  if (r == 0)
+    {
+      errno = ETIMEDOUT;
+      goto fail;
+    }
+  if (read(fd, &grant, (size_t)1) != 1)
+    {
+      errno = ECONNRESET;
+      goto fail;
+    }
+  *waited = (grant != 0);
+  return fd;
+  
+ fail:
+  r = errno;
+  close(fd);
+  errno = r;
+  return -1;
+}
@@ -0,0 +1,37 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Ask autohaltd-coord, on the socket named by the environment
+ * variable AUTOHALTD_COORD, for a turn to halt the machine, and
+ * wait until it is granted. The turn lasts until the returned
+ * file descriptor is closed; it is not closed on exec, so that
+ * shutdown(8) holds it.
+ * 
+ * If the coordinator cannot be reached, or does not answer in
+ * `AUTOHALTD_COORD_TIMEOUT` seconds, the machine should halt
+ * anyway: a broken coordinator must not keep machines up.
+ * 
+ * @param   waited  Output parameter for whether the machine had
+ *                  to wait for its turn, in which case it may have
+ *                  been used meanwhile, and should be checked again.
+ * @return          A file descriptor that holds the turn, -1 if the
+ *                  halt is not coordinated, with `errno` set to zero
+ *                  if AUTOHALTD_COORD is not set.
+ */
+int acquire_halt_slot(int* waited);
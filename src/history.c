@@ -0,0 +1,596 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "history.h"
+#include "replay.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utmpx.h>
+#include <utmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * The number of records read from wtmp at a time.
+ */
+#define HISTORY_CHUNK  1024
+
+
+
+/**
+ * How far wtmp has been replayed, as carried across
+ * checks in the environment variable AUTOHALTD_WTMP_STATE,
+ * so that only the records appended since are read.
+ */
+struct resume
+{
+  /**
+   * The inode number of wtmp.
+   */
+  uintmax_t ino;
+  
+  /**
+   * The number of records that have been replayed.
+   */
+  uintmax_t offset;
+  
+  /**
+   * The time of the last record that was replayed,
+   * from wtmp or lastlog.
+   */
+  long long int seen;
+  
+  /**
+   * `last.tv_sec` of the replay.
+   */
+  long long int last_sec;
+  
+  /**
+   * `last.tv_nsec` of the replay.
+   */
+  long long int last_nsec;
+  
+  /**
+   * `delta.tv_sec` of the replay.
+   */
+  long long int delta_sec;
+  
+  /**
+   * `delta.tv_nsec` of the replay.
+   */
+  long long int delta_nsec;
+  
+  /**
+   * `oldtime.tv_sec` of the replay.
+   */
+  long long int oldtime_sec;
+  
+  /**
+   * `oldtime.tv_nsec` of the replay.
+   */
+  long long int oldtime_nsec;
+  
+  /**
+   * `have_oldtime` of the replay.
+   */
+  long long int have_oldtime;
+};
+
+
+/**
+ * A login database, read as a stream of records,
+ * in the order they were written.
+ */
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+struct stream
+{
+  /**
+   * Get the next record.
+   * 
+   * @param   s  The stream.
+   * @return     The record, `NULL` at the end, or on error,
+   *             in which case `errno` is set to non-zero.
+   */
+  const struct utmpx* (*next)(struct stream* s);
+  
+  /**
+   * The file, -1 if closed.
+   */
+  int fd;
+  
+  /**
+   * Where to resume the replay of wtmp, `NULL` to start over.
+   * Set to `NULL` by `wtmp_open` if it does not apply.
+   */
+  const struct resume* resume;
+  
+  /**
+   * The inode number of the file.
+   */
+  uintmax_t ino;
+  
+  /**
+   * The number of whole records in the file.
+   */
+  size_t size;
+  
+  /**
+   * The index, in the file, of the first record
+   * that has not been read.
+   */
+  size_t offset;
+  
+  /**
+   * The records that have been read, but not streamed.
+   */
+  struct utmpx* records;
+  
+  /**
+   * The indices, in `records`, of the records of interest.
+   */
+  unsigned int* index;
+  
+  /**
+   * The number of elements in `index`.
+   */
+  size_t n;
+  
+  /**
+   * The number of elements in `index` that have been streamed.
+   */
+  size_t i;
+  
+  /**
+   * The times of the logins in lastlog, in ascending order.
+   */
+  time_t* times;
+  
+  /**
+   * The record streamed from lastlog.
+   */
+  struct utmpx record;
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
+/**
+ * Read whole records from a file.
+ * 
+ * @param   fd       The file.
+ * @param   records  Output parameter for the records.
+ * @param   n        The number of records to read.
+ * @param   offset   The index of the first record to read.
+ * @return           The number of records read, -1 on error.
+ */
+static ssize_t read_records(int fd, struct utmpx* records, size_t n, size_t offset)
+{
+  char* buf = (char*)records;
+  size_t got = 0, size = n * sizeof(*records);
+  ssize_t r;
+  
+  while (got < size)
+    {
+      r = pread(fd, buf + got, size - got, (off_t)(offset * sizeof(*records) + got));
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if (r == 0)
+	break;
+      got += (size_t)r;
+    }
+  return (ssize_t)(got / sizeof(*records));
+}
+
+
+/**
+ * Get the next record of interest from wtmp,
+ * see `struct stream`.
+ * 
+ * @param   s  The stream.
+ * @return     The record, `NULL` at the end, or on error.
+ */
+static const struct utmpx* wtmp_next(struct stream* s)
+{
+  ssize_t got;
+  
+  while (s->i == s->n)
+    {
+      if (s->offset == s->size)
+	return NULL;
+      got = read_records(s->fd, s->records, (size_t)HISTORY_CHUNK, s->offset);
+      if (got <= 0)
+	return NULL;
+      s->offset += (size_t)got;
+      s->n = replay_filter(s->records, (size_t)got, REPLAY_TYPES, s->index);
+      s->i = 0;
+    }
+  return s->records + s->index[s->i++];
+}
+
+
+/**
+ * Open wtmp, where its replay was left off, if it has only
+ * been appended to since, otherwise at its last boot record.
+ * 
+ * @param   s     Output parameter for the stream.
+ * @param   path  The pathname of wtmp.
+ * @return        Zero on success, -1 on error.
+ */
+static int wtmp_open(struct stream* s, const char* path)
+{
+  struct stat attr;
+  size_t start, end;
+  ssize_t got;
+  size_t k;
+  
+  s->fd = -1;
+  s->next = wtmp_next;
+  s->records = malloc(HISTORY_CHUNK * sizeof(*(s->records)));
+  s->index = malloc(HISTORY_CHUNK * sizeof(*(s->index)));
+  if ((s->records == NULL) || (s->index == NULL))
+    return -1;
+  s->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if ((s->fd < 0) || fstat(s->fd, &attr))
+    return -1;
+  s->ino = (uintmax_t)(attr.st_ino);
+  s->size = (size_t)(attr.st_size) / sizeof(*(s->records));
+  
+  /* If wtmp has not been rotated, or truncated, since it was
+   * last replayed, only the records after that are of interest. */
+  if (s->resume && (s->resume->ino == s->ino) && (s->resume->offset <= (uintmax_t)(s->size)))
+    {
+      s->offset = (size_t)(s->resume->offset);
+      return 0;
+    }
+  s->resume = NULL;
+  
+  /* Records before the last boot are of no interest, and wtmp
+   * is seldom rotated, so look for it from the end, a chunk at
+   * a time. If there is none, start from the beginning. */
+  for (end = s->size; end > 0; end = start)
+    {
+      start = end > HISTORY_CHUNK ? end - HISTORY_CHUNK : 0;
+      got = read_records(s->fd, s->records, end - start, start);
+      if (got < 0)
+	return -1;
+      k = replay_filter(s->records, (size_t)got, 1U << BOOT_TIME, s->index);
+      if (k)
+	{
+	  s->offset = start + s->index[k - 1];
+	  break;
+	}
+    }
+  (void) posix_fadvise(s->fd, (off_t)(s->offset * sizeof(*(s->records))), (off_t)0, POSIX_FADV_SEQUENTIAL);
+  return 0;
+}
+
+
+/**
+ * Get the next login from lastlog, see `struct stream`.
+ * 
+ * @param   s  The stream.
+ * @return     The record, `NULL` at the end.
+ */
+static const struct utmpx* lastlog_next(struct stream* s)
+{
+  if (s->i == s->n)
+    return NULL;
+  s->record.ut_type = USER_PROCESS;
+  s->record.ut_tv.tv_sec = (int32_t)(s->times[s->i++]);
+  return &s->record;
+}
+
+
+/**
+ * Compare two times.
+ * 
+ * @param   a  One of the times.
+ * @param   b  The other time.
+ * @return     Negative if `a` is earlier, positive if
+ *             `b` is earlier, zero otherwise.
+ */
+static int timecmp(const void* a, const void* b)
+{
+  time_t x = *(const time_t*)a;
+  time_t y = *(const time_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Open lastlog, and read the time of the last
+ * login of each user.
+ * 
+ * lastlog is an array indexed by user ID, and sparse
+ * if the user IDs are, so only the parts of it with
+ * data are read.
+ * 
+ * @param   s     Output parameter for the stream.
+ * @param   path  The pathname of lastlog.
+ * @return        Zero on success, -1 on error.
+ */
+static int lastlog_open(struct stream* s, const char* path)
+{
+  struct lastlog* map = MAP_FAILED;
+  struct stat attr;
+  size_t uid, end, size = 0;
+  off_t data, hole;
+  void* new;
+  int saved_errno;
+  
+  s->fd = -1;
+  s->next = lastlog_next;
+  s->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if ((s->fd < 0) || fstat(s->fd, &attr))
+    return -1;
+  s->size = (size_t)(attr.st_size) / sizeof(*map);
+  if (s->size == 0)
+    return 0;
+  map = mmap(NULL, s->size * sizeof(*map), PROT_READ, MAP_PRIVATE, s->fd, (off_t)0);
+  if (map == MAP_FAILED)
+    return -1;
+  
+  for (data = 0;; data = hole)
+    {
+      /* Skip the holes, which are users that have never logged in. */
+      data = lseek(s->fd, data, SEEK_DATA);
+      if (data < 0)
+	{
+	  if (errno == ENXIO)
+	    break;
+	  if (errno != EINVAL)
+	    goto fail;
+	  data = 0; /* SEEK_DATA is not supported. */
+	  hole = attr.st_size;
+	}
+      else
+	{
+	  hole = lseek(s->fd, data, SEEK_HOLE);
+	  if (hole < 0)
+	    goto fail;
+	}
+      
+      uid = (size_t)data / sizeof(*map);
+      end = ((size_t)hole + sizeof(*map) - 1) / sizeof(*map);
+      if (end > s->size)
+	end = s->size;
+      for (; uid < end; uid++)
+	{
+	  if (map[uid].ll_time <= 0)
+	    continue;
+	  if (s->n == size)
+	    {
+	      size = size ? (size << 1) : 64;
+	      new = realloc(s->times, size * sizeof(*(s->times)));
+	      if (new == NULL)
+		goto fail;
+	      s->times = new;
+	    }
+	  s->times[s->n++] = (time_t)(map[uid].ll_time);
+	}
+      if (hole >= attr.st_size)
+	break;
+    }
+  
+  munmap(map, s->size * sizeof(*map));
+  qsort(s->times, s->n, sizeof(*(s->times)), timecmp);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  munmap(map, s->size * sizeof(*map));
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Read where the replay of wtmp was left off from the
+ * environment variable AUTOHALTD_WTMP_STATE.
+ * 
+ * @param   resume  Output parameter for the state.
+ * @return          1 if the state was read, 0 if it is missing or malformed.
+ */
+static int read_resume(struct resume* resume)
+{
+  const char* env = getenv("AUTOHALTD_WTMP_STATE");
+  if (env == NULL)
+    return 0;
+  return sscanf(env, "%ju %ju %lli %lli %lli %lli %lli %lli %lli %lli",
+		&resume->ino, &resume->offset, &resume->seen,
+		&resume->last_sec, &resume->last_nsec, &resume->delta_sec, &resume->delta_nsec,
+		&resume->oldtime_sec, &resume->oldtime_nsec, &resume->have_oldtime) == 10;
+}
+
+
+/**
+ * Store where the replay of wtmp was left off in the
+ * environment variable AUTOHALTD_WTMP_STATE.
+ * 
+ * @param   s      The wtmp stream, read to its end.
+ * @param   seen   The time of the last record that was replayed.
+ * @param   state  The replay.
+ * @return         Zero on success, -1 on error.
+ */
+static int write_resume(const struct stream* s, long long int seen, const struct replay* state)
+{
+  char envval[10 * 3 * sizeof(uintmax_t) + 11];
+  sprintf(envval, "%ju %ju %lli %lli %lli %lli %lli %lli %lli %lli",
+	  s->ino, (uintmax_t)(s->offset), seen,
+	  (long long int)(state->last.tv_sec), (long long int)(state->last.tv_nsec),
+	  (long long int)(state->delta.tv_sec), (long long int)(state->delta.tv_nsec),
+	  (long long int)(state->oldtime.tv_sec), (long long int)(state->oldtime.tv_nsec),
+	  (long long int)(state->have_oldtime));
+  return setenv("AUTOHALTD_WTMP_STATE", envval, 1);
+}
+
+
+/**
+ * Get the time elapsed since the last login or logout
+ * recorded in the wtmp file named by the environment
+ * variable AUTOHALTD_WTMP, and the last login recorded
+ * in the lastlog file named by AUTOHALTD_LASTLOG. This
+ * catches logins that utmp does not know about, or has
+ * forgotten. Only the records since the last boot
+ * recorded in wtmp are of interest.
+ * 
+ * The replay is carried across checks in the environment
+ * variable AUTOHALTD_WTMP_STATE, so that only the records
+ * appended to wtmp since the last check are read.
+ * 
+ * @param   now       The current time.
+ * @param   duration  Output parameter for the elapsed time.
+ * @return            1 if `duration` was set, 0 if neither
+ *                    file is configured, -1 on error.
+ */
+int get_history_idle_time(const struct timespec* now, struct timespec* duration)
+{
+  static int (*const openers[])(struct stream* s, const char* path) = {
+    wtmp_open,
+    lastlog_open,
+  };
+  const char* paths[sizeof(openers) / sizeof(*openers)];
+  struct stream streams[sizeof(openers) / sizeof(*openers)];
+  const struct utmpx* heads[sizeof(openers) / sizeof(*openers)];
+  struct stream* wtmp = NULL;
+  struct replay state;
+  struct resume resume;
+  struct timespec epoch;
+  struct utmpx u;
+  long long int seen = 0;
+  size_t i, k = 0, first;
+  int rc = -1, saved_errno, have_resume;
+  
+  paths[0] = getenv("AUTOHALTD_WTMP");
+  paths[1] = getenv("AUTOHALTD_LASTLOG");
+  
+  memset(&epoch, 0, sizeof(epoch));
+  replay_init(&state, &epoch);
+  have_resume = read_resume(&resume);
+  
+  /* Open the databases, each is in chronological order. */
+  for (i = 0; i < sizeof(openers) / sizeof(*openers); i++)
+    {
+      if ((paths[i] == NULL) || (*(paths[i]) == '\0'))
+	continue;
+      memset(streams + k, 0, sizeof(*streams));
+      streams[k].resume = have_resume ? &resume : NULL;
+      if (openers[i](streams + k++, paths[i]))
+	{
+	  if (errno != ENOENT)
+	    goto done;
+	  close(streams[--k].fd);
+	  free(streams[k].records);
+	  free(streams[k].index);
+	  free(streams[k].times);
+	}
+      else if (openers[i] == wtmp_open)
+	wtmp = streams + k - 1;
+    }
+  if (k == 0)
+    {
+      rc = 0;
+      goto done;
+    }
+  for (i = 0; i < k; i++)
+    if (errno = 0, !(heads[i] = streams[i].next(streams + i)) && errno)
+      goto done;
+  
+  /* Pick up the replay where it was left off. The records before
+   * that in lastlog have already been replayed, and those after
+   * it in wtmp are the ones that have been appended since. */
+  if (wtmp && wtmp->resume)
+    {
+      state.last.tv_sec = (time_t)(resume.last_sec);
+      state.last.tv_nsec = (long int)(resume.last_nsec);
+      state.delta.tv_sec = (time_t)(resume.delta_sec);
+      state.delta.tv_nsec = (long int)(resume.delta_nsec);
+      state.oldtime.tv_sec = (time_t)(resume.oldtime_sec);
+      state.oldtime.tv_nsec = (long int)(resume.oldtime_nsec);
+      state.have_oldtime = (int)(resume.have_oldtime);
+      seen = resume.seen;
+    }
+  
+  /* Replay them as one, merged by time, so that changes of
+   * the clock in wtmp apply to the logins from lastlog. */
+  for (;;)
+    {
+      for (first = k, i = 0; i < k; i++)
+	if (heads[i] && ((first == k) ||
+			 (heads[i]->ut_tv.tv_sec < heads[first]->ut_tv.tv_sec) ||
+			 ((heads[i]->ut_tv.tv_sec == heads[first]->ut_tv.tv_sec) &&
+			  (heads[i]->ut_tv.tv_usec < heads[first]->ut_tv.tv_usec))))
+	  first = i;
+      if (first == k)
+	break;
+      
+      /* A login counts as activity, whether it has ended or
+       * not; logins that have not are found in utmp. */
+      u = *(heads[first]);
+      if (u.ut_type == USER_PROCESS)
+	{
+	  u.ut_type = DEAD_PROCESS;
+	  u.ut_pid = 0;
+	}
+      if ((streams + first == wtmp) || ((long long int)(u.ut_tv.tv_sec) > seen))
+	if (replay_record(&state, &u) < 0)
+	  goto done;
+      if ((long long int)(u.ut_tv.tv_sec) > seen)
+	seen = (long long int)(u.ut_tv.tv_sec);
+      
+      errno = 0;
+      heads[first] = streams[first].next(streams + first);
+      if (!heads[first] && errno)
+	goto done;
+    }
+  
+  if (wtmp && write_resume(wtmp, seen, &state))
+    goto done;
+  replay_idle_time(&state, now, duration);
+  rc = 1;
+  
+ done:
+  saved_errno = errno;
+  for (i = 0; i < k; i++)
+    {
+      close(streams[i].fd);
+      free(streams[i].records);
+      free(streams[i].index);
+      free(streams[i].times);
+    }
+  replay_destroy(&state);
+  errno = saved_errno;
+  return rc;
+}
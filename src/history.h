@@ -0,0 +1,35 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+
+/**
+ * Get the time elapsed since the last login or logout
+ * recorded in the wtmp file named by the environment
+ * variable AUTOHALTD_WTMP, and the last login recorded
+ * in the lastlog file named by AUTOHALTD_LASTLOG. This
+ * catches logins that utmp does not know about, or has
+ * forgotten. Only the records since the last boot
+ * recorded in wtmp are of interest.
+ * 
+ * @param   now       The current time.
+ * @param   duration  Output parameter for the elapsed time.
+ * @return            1 if `duration` was set, 0 if neither
+ *                    file is configured, -1 on error.
+ */
+int get_history_idle_time(const struct timespec* now, struct timespec* duration);
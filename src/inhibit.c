@@ -0,0 +1,218 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "inhibit.h"
+#include "source.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+
+
+/**
+ * Check whether a process holds a lock on a file.
+ * 
+ * @param   dirfd  The directory with the file.
+ * @param   name   The name of the file.
+ * @return         1 if the lock is held, 0 if it is not, or
+ *                 if the file is not a regular file, -1 on error.
+ */
+static int is_locked(int dirfd, const char* name)
+{
+  struct stat attr;
+  int fd, r, saved_errno;
+  
+  /* Anyone can create files here, only regular files
+   * are opened, and without following symbolic links. */
+  if (fstatat(dirfd, name, &attr, AT_SYMLINK_NOFOLLOW))
+    return errno == ENOENT ? 0 : -1;
+  if (!S_ISREG(attr.st_mode))
+    return 0;
+  fd = openat(dirfd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW);
+  if (fd == -1)
+    return ((errno == ENOENT) || (errno == ELOOP)) ? 0 : -1;
+  
+  /* An exclusive lock cannot be taken if any process holds
+   * a lock, shared or exclusive. If it can, it is released
+   * when the file is closed. */
+  r = flock(fd, LOCK_EX | LOCK_NB) ? (errno == EWOULDBLOCK ? 1 : -1) : 0;
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return r;
+}
+
+
+/**
+ * Count the files in `AUTOHALTD_INHIBIT_DIRECTORY` that
+ * a process holds a flock(2) on. Whether the count is
+ * non-zero is recorded in the environment variable
+ * AUTOHALTD_INHIBITED, for `inhibit_source`.
+ * 
+ * @return  The number of held locks, -1 on error.
+ */
+int count_inhibitors(void)
+{
+  struct dirent* f;
+  DIR* dir;
+  int r, rc = 0, saved_errno;
+  
+  dir = opendir(AUTOHALTD_INHIBIT_DIRECTORY);
+  if (dir == NULL)
+    {
+      if (errno != ENOENT)
+	return -1;
+      goto done; /* autohaltd is not running. */
+    }
+  
+  for (errno = 0; (f = readdir(dir)); errno = 0)
+    {
+      if (*(f->d_name) == '.')
+	continue;
+      r = is_locked(dirfd(dir), f->d_name);
+      if (r < 0)
+	goto fail;
+#ifdef DEBUG
+      if (r)
+	fprintf(stderr, "Inhibitor: %s\n", f->d_name);
+#endif
+      if (r && (rc < INT_MAX))
+	rc++;
+    }
+  if (errno)
+    goto fail;
+  
+  saved_errno = errno;
+  closedir(dir);
+  errno = saved_errno;
+ done:
+  if (rc ? setenv("AUTOHALTD_INHIBITED", "1", 1) : unsetenv("AUTOHALTD_INHIBITED"))
+    return -1;
+  return rc;
+  
+ fail:
+  saved_errno = errno;
+  closedir(dir);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Watch the inhibitor directory, if the last check
+ * found a held lock, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int inhibit_open(int epfd, unsigned index)
+{
+  struct epoll_event ev;
+  char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+  int fd, r, saved_errno;
+  
+  if (getenv("AUTOHALTD_INHIBITED") == NULL)
+    return 0;
+  
+  /* A lock is released when the holder closes the file,
+   * or removes it, or exits. */
+  fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (fd < 0)
+    return -1;
+  if (inotify_add_watch(fd, AUTOHALTD_INHIBIT_DIRECTORY, IN_CLOSE | IN_DELETE | IN_MOVED_FROM) < 0)
+    {
+      if (errno != ENOENT)
+	goto fail;
+      close(fd);
+      return 0;
+    }
+  
+  /* The last lock may have been released before it was watched.
+   * Testing the locks closes the files, so drop those events.
+   * If none is held, ask for a check at once. */
+  r = count_inhibitors();
+  if (r < 0)
+    goto fail;
+  while (read(fd, buf, sizeof(buf)) > 0)
+    continue;
+  if (r == 0)
+    {
+      close(fd);
+      fd = eventfd(1U, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (fd < 0)
+	return -1;
+    }
+  
+  ev.events = EPOLLIN;
+  ev.data.u64 = SOURCE_DATA(index, fd);
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+    goto fail;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Handle a change in the inhibitor directory, see `struct source`.
+ * 
+ * @param   epfd    The epoll(7) instance.
+ * @param   index   The index of the source.
+ * @param   fd      The file descriptor.
+ * @param   events  The epoll(7) events.
+ * @return          1, the machine shall be checked now.
+ */
+static int inhibit_handle(int epfd, unsigned index, int fd, uint32_t events)
+{
+  /* The locks are tested by the check, since testing
+   * them here would cause new events. */
+  (void) epfd;
+  (void) index;
+  (void) fd;
+  (void) events;
+  return 1;
+}
+
+
+/**
+ * Activity source that requests a check when a lock
+ * in `AUTOHALTD_INHIBIT_DIRECTORY` may have been
+ * released, if the last check found any.
+ */
+const struct source inhibit_source = {
+  .open   = inhibit_open,
+  .handle = inhibit_handle,
+  .tick   = NULL,
+  .save   = NULL,
+};
@@ -0,0 +1,36 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+struct source;
+
+
+
+/**
+ * Count the files in `AUTOHALTD_INHIBIT_DIRECTORY` that
+ * a process holds a flock(2) on. Whether the count is
+ * non-zero is recorded in the environment variable
+ * AUTOHALTD_INHIBITED, for `inhibit_source`.
+ * 
+ * @return  The number of held locks, -1 on error.
+ */
+int count_inhibitors(void);
+
+/**
+ * Activity source that requests a check when a lock
+ * in `AUTOHALTD_INHIBIT_DIRECTORY` may have been
+ * released, if the last check found any.
+ */
+extern const struct source inhibit_source;
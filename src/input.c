@@ -0,0 +1,356 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "input.h"
+#include "source.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+
+
+/**
+ * The inotify(7) instance that watches for hotplugged
+ * devices, -1 if input is not being watched.
+ */
+static int watch = -1;
+
+/**
+ * The open input devices, -1 for closed slots.
+ */
+static int* devices = NULL;
+
+/**
+ * The number of elements in `devices`.
+ */
+static size_t ndevices = 0;
+
+/**
+ * The time of the last input, per `CLOCK_REALTIME`.
+ */
+static time_t last_input;
+
+/**
+ * The time, per `CLOCK_MONOTONIC`, when the input
+ * devices shall be watched again, 0 if they are watched.
+ */
+static time_t rearm_time = 0;
+
+
+
+/**
+ * Get how long it has been since the last input, as
+ * recorded by `input_source` in the environment variable
+ * AUTOHALTD_INPUT_LAST.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of
+ *                seconds since the last input.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_INPUT
+ *                or AUTOHALTD_INPUT_LAST is not set.
+ */
+int get_input_idle_time(time_t now, unsigned long long int* idle)
+{
+  const char* dir = getenv("AUTOHALTD_INPUT");
+  const char* last = getenv("AUTOHALTD_INPUT_LAST");
+  time_t t;
+  
+  if (!dir || !*dir || !last || !*last)
+    return 0;
+  t = (time_t)atoll(last);
+  *idle = (now > t) ? (unsigned long long int)(now - t) : 0;
+  return 1;
+}
+
+
+/**
+ * Discard everything that can be read from a device.
+ * The content is never looked at.
+ * 
+ * @param   fd  The file descriptor of the device.
+ * @return      1 if anything was read, 0 otherwise.
+ */
+static int drain(int fd)
+{
+  char buf[1024];
+  int any = 0;
+  while (read(fd, buf, sizeof(buf)) > 0)
+    any = 1;
+  return any;
+}
+
+
+/**
+ * Record that there has been input.
+ */
+static void record_input(void)
+{
+  struct timespec now;
+  if (!clock_now(CLOCK_REALTIME, &now))
+    last_input = now.tv_sec;
+}
+
+
+/**
+ * Open an input device and start watching it.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @param   dirfd  File descriptor for the device directory.
+ * @param   name   The name of the device.
+ * @return         Zero on success, -1 on error.
+ */
+static int add_device(int epfd, unsigned index, int dirfd, const char* name)
+{
+  struct epoll_event ev;
+  size_t i;
+  void* new;
+  int fd;
+  
+  if (strncmp(name, "event", sizeof("event") - 1))
+    return 0;
+  
+  fd = openat(dirfd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0)
+    return 0; /* Not ready yet, or already removed. */
+  drain(fd);
+  
+  for (i = 0; i < ndevices; i++)
+    if (devices[i] < 0)
+      break;
+  if (i == ndevices)
+    {
+      new = realloc(devices, (ndevices + 1) * sizeof(*devices));
+      if (new == NULL)
+	goto fail;
+      devices = new;
+      ndevices++;
+    }
+  devices[i] = fd;
+  
+  /* One-shot, so that only the first input after re-arming wakes us. */
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.u64 = SOURCE_DATA(index, fd);
+  if (rearm_time)
+    ev.events = EPOLLONESHOT; /* Disarmed until `rearm_time`. */
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+    {
+      devices[i] = -1;
+      goto fail;
+    }
+  return 0;
+  
+ fail:
+  close(fd);
+  return -1;
+}
+
+
+/**
+ * Start watching the input devices, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int input_open(int epfd, unsigned index)
+{
+  const char* path = getenv("AUTOHALTD_INPUT");
+  const char* last = getenv("AUTOHALTD_INPUT_LAST");
+  struct epoll_event ev;
+  struct dirent* f;
+  DIR* dir;
+  
+  if ((path == NULL) || (*path == '\0'))
+    return 0;
+  if (last && *last)
+    last_input = (time_t)atoll(last);
+  else
+    record_input(); /* Assume the machine is in use when autohaltd starts. */
+  
+  /* Watch for hotplugged devices before listing the devices, so none is missed. */
+  watch = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (watch < 0)
+    return -1;
+  if (inotify_add_watch(watch, path, IN_CREATE) < 0)
+    goto fail;
+  ev.events = EPOLLIN;
+  ev.data.u64 = SOURCE_DATA(index, watch);
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, watch, &ev))
+    goto fail;
+  
+  dir = opendir(path);
+  if (dir == NULL)
+    goto fail;
+  while ((f = readdir(dir)))
+    if (add_device(epfd, index, dirfd(dir), f->d_name))
+      {
+	closedir(dir);
+	goto fail;
+      }
+  closedir(dir);
+  return 0;
+  
+ fail:
+  close(watch);
+  watch = -1;
+  return -1;
+}
+
+
+/**
+ * Handle input, or a hotplugged device, see `struct source`.
+ * 
+ * @param   epfd    The epoll(7) instance.
+ * @param   index   The index of the source.
+ * @param   fd      The file descriptor.
+ * @param   events  The epoll(7) events.
+ * @return          0 on success, -1 on error.
+ */
+static int input_handle(int epfd, unsigned index, int fd, uint32_t events)
+{
+  union
+  {
+    struct inotify_event event;
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+  } u;
+  const struct inotify_event* e;
+  struct timespec now;
+  ssize_t n;
+  size_t i;
+  int dirfd;
+  
+  if (fd == watch)
+    {
+      /* New devices. */
+      dirfd = open(getenv("AUTOHALTD_INPUT"), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dirfd < 0)
+	return -1;
+      while ((n = read(watch, u.buf, sizeof(u.buf))) > 0)
+	for (i = 0; i < (size_t)n;)
+	  {
+	    e = (const struct inotify_event*)(void*)(u.buf + i);
+	    if (e->len && add_device(epfd, index, dirfd, e->name))
+	      break;
+	    i += sizeof(*e) + e->len;
+	  }
+      close(dirfd);
+      return 0;
+    }
+  
+  if (events & (EPOLLERR | EPOLLHUP))
+    {
+      /* Unplugged device. */
+      epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+      close(fd);
+      for (i = 0; i < ndevices; i++)
+	if (devices[i] == fd)
+	  devices[i] = -1;
+      return 0;
+    }
+  
+  /* Input. Leave the devices disarmed for a while,
+   * and look again when they are re-armed. */
+  if (drain(fd))
+    record_input();
+  if (!rearm_time && !clock_now(CLOCK_MONOTONIC, &now))
+    rearm_time = now.tv_sec + AUTOHALTD_INPUT_COALESCE;
+  return 0;
+}
+
+
+/**
+ * Re-arm the input devices, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @param   now    The time, per `CLOCK_MONOTONIC`.
+ * @return         The number of seconds until this function
+ *                 shall be called again, 0 if it need not be called.
+ */
+static time_t input_tick(int epfd, unsigned index, time_t now)
+{
+  struct epoll_event ev;
+  size_t i;
+  int any = 0;
+  
+  if (!rearm_time)
+    return 0;
+  if (now < rearm_time)
+    return rearm_time - now;
+  
+  /* Was there input while the devices were disarmed? Then keep them disarmed. */
+  for (i = 0; i < ndevices; i++)
+    if ((devices[i] >= 0) && drain(devices[i]))
+      any = 1;
+  if (any)
+    {
+      record_input();
+      rearm_time = now + AUTOHALTD_INPUT_COALESCE;
+      return AUTOHALTD_INPUT_COALESCE;
+    }
+  
+  rearm_time = 0;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  for (i = 0; i < ndevices; i++)
+    if (devices[i] >= 0)
+      {
+	ev.data.u64 = SOURCE_DATA(index, devices[i]);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, devices[i], &ev);
+      }
+  return 0;
+}
+
+
+/**
+ * Store the time of the last input in the
+ * environment, see `struct source`.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int input_save(void)
+{
+  char envval[3 * sizeof(long long int) + 2];
+  if (watch < 0)
+    return 0;
+  sprintf(envval, "%lli", (long long int)last_input);
+  return setenv("AUTOHALTD_INPUT_LAST", envval, 1);
+}
+
+
+/**
+ * Activity source that records the time of the last
+ * event from the input devices in the directory specified
+ * by the environment variable AUTOHALTD_INPUT.
+ */
+const struct source input_source = {
+  .open   = input_open,
+  .handle = input_handle,
+  .tick   = input_tick,
+  .save   = input_save,
+};
+
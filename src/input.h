@@ -0,0 +1,43 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct source;
+
+
+
+/**
+ * Get how long it has been since the last input, as
+ * recorded by `input_source` in the environment variable
+ * AUTOHALTD_INPUT_LAST.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of
+ *                seconds since the last input.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_INPUT
+ *                or AUTOHALTD_INPUT_LAST is not set.
+ */
+int get_input_idle_time(time_t now, unsigned long long int* idle);
+
+/**
+ * Activity source that records the time of the last
+ * event from the input devices in the directory specified
+ * by the environment variable AUTOHALTD_INPUT.
+ */
+extern const struct source input_source;
+
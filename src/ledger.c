@@ -0,0 +1,170 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "ledger.h"
+#include "replay.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * The contents of the ledger.
+ */
+struct ledger
+{
+  /**
+   * The time of the last logout, on CLOCK_BOOTTIME.
+   */
+  long long int boot;
+  
+  /**
+   * The time of the last logout, as recorded in utmp.
+   */
+  long long int last_sec;
+  
+  /**
+   * The nanoseconds of `last_sec`.
+   */
+  long long int last_nsec;
+  
+  /**
+   * The inode number of utmp.
+   */
+  uintmax_t ino;
+  
+  /**
+   * The size of utmp.
+   */
+  uintmax_t size;
+  
+  /**
+   * The modification time of utmp.
+   */
+  long long int mtime_sec;
+  
+  /**
+   * The nanoseconds of `mtime_sec`.
+   */
+  long long int mtime_nsec;
+};
+
+
+
+/**
+ * Read the ledger from the environment.
+ * 
+ * @param   ledger  Output parameter for the ledger.
+ * @return          1 if the ledger was read, 0 if it is missing or malformed.
+ */
+static int read_ledger(struct ledger* ledger)
+{
+  const char* env = getenv("AUTOHALTD_LEDGER");
+  if (env == NULL)
+    return 0;
+  return sscanf(env, "%lli %lli %lli %ju %ju %lli %lli",
+		&ledger->boot, &ledger->last_sec, &ledger->last_nsec,
+		&ledger->ino, &ledger->size, &ledger->mtime_sec, &ledger->mtime_nsec) == 7;
+}
+
+
+/**
+ * Get the time since the last logout from the ledger in the
+ * environment variable AUTOHALTD_LEDGER, which counts it on
+ * CLOCK_BOOTTIME, so that changes of the system clock do not
+ * affect it. The ledger is only valid as long as utmp has
+ * not changed since it was written.
+ * 
+ * @param   attr      The current attributes of utmp.
+ * @param   duration  Output parameter for the time since the last logout.
+ * @return            1 if `duration` was set, 0 if the ledger is
+ *                    missing or outdated, -1 on error.
+ */
+int get_ledger_idle_time(const struct stat* attr, struct timespec* duration)
+{
+  struct ledger ledger;
+  struct timespec boot;
+  
+  if (!read_ledger(&ledger))
+    return 0;
+  if ((ledger.ino != (uintmax_t)(attr->st_ino)) ||
+      (ledger.size != (uintmax_t)(attr->st_size)) ||
+      (ledger.mtime_sec != (long long int)(attr->st_mtim.tv_sec)) ||
+      (ledger.mtime_nsec != (long long int)(attr->st_mtim.tv_nsec)))
+    return 0;
+  
+  if (clock_now(CLOCK_BOOTTIME, &boot))
+    return -1;
+  if ((long long int)(boot.tv_sec) < ledger.boot)
+    return 0; /* The machine has rebooted. */
+  duration->tv_sec = (time_t)((long long int)(boot.tv_sec) - ledger.boot);
+  duration->tv_nsec = 0;
+  return 1;
+}
+
+
+/**
+ * Reconcile the ledger in the environment variable AUTOHALTD_LEDGER
+ * with a replay of utmp. If the last logout is the same as when the
+ * ledger was written, the time since it is kept from the ledger,
+ * otherwise it is taken from the replay.
+ * 
+ * @param   attr      The attributes of utmp, from before it was replayed.
+ * @param   state     The replay of utmp.
+ * @param   duration  The time since the last logout according to the
+ *                    replay. Will be updated to the time according to
+ *                    the ledger.
+ * @return            Zero on success, -1 on error.
+ */
+int update_ledger(const struct stat* attr, const struct replay* state, struct timespec* duration)
+{
+  char envval[7 * 3 * sizeof(uintmax_t) + 8];
+  struct ledger ledger;
+  struct timespec boot;
+  
+  if (clock_now(CLOCK_BOOTTIME, &boot))
+    return -1;
+  
+  if (!read_ledger(&ledger) ||
+      (ledger.last_sec != (long long int)(state->last.tv_sec)) ||
+      (ledger.last_nsec != (long long int)(state->last.tv_nsec)) ||
+      ((long long int)(boot.tv_sec) < ledger.boot))
+    {
+      /* There has been a logout since the ledger was written. */
+      ledger.boot = (long long int)(boot.tv_sec) - (long long int)(duration->tv_sec);
+      ledger.last_sec = (long long int)(state->last.tv_sec);
+      ledger.last_nsec = (long long int)(state->last.tv_nsec);
+    }
+  else
+    {
+      duration->tv_sec = (time_t)((long long int)(boot.tv_sec) - ledger.boot);
+      duration->tv_nsec = 0;
+    }
+  
+  sprintf(envval, "%lli %lli %lli %ju %ju %lli %lli",
+	  ledger.boot, ledger.last_sec, ledger.last_nsec,
+	  (uintmax_t)(attr->st_ino), (uintmax_t)(attr->st_size),
+	  (long long int)(attr->st_mtim.tv_sec), (long long int)(attr->st_mtim.tv_nsec));
+  return setenv("AUTOHALTD_LEDGER", envval, 1);
+}
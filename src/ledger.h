@@ -0,0 +1,52 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct stat;
+struct replay;
+
+
+
+/**
+ * Get the time since the last logout from the ledger in the
+ * environment variable AUTOHALTD_LEDGER, which counts it on
+ * CLOCK_BOOTTIME, so that changes of the system clock do not
+ * affect it. The ledger is only valid as long as utmp has
+ * not changed since it was written.
+ * 
+ * @param   attr      The current attributes of utmp.
+ * @param   duration  Output parameter for the time since the last logout.
+ * @return            1 if `duration` was set, 0 if the ledger is
+ *                    missing or outdated, -1 on error.
+ */
+int get_ledger_idle_time(const struct stat* attr, struct timespec* duration);
+
+/**
+ * Reconcile the ledger in the environment variable AUTOHALTD_LEDGER
+ * with a replay of utmp. If the last logout is the same as when the
+ * ledger was written, the time since it is kept from the ledger,
+ * otherwise it is taken from the replay.
+ * 
+ * @param   attr      The attributes of utmp, from before it was replayed.
+ * @param   state     The replay of utmp.
+ * @param   duration  The time since the last logout according to the
+ *                    replay. Will be updated to the time according to
+ *                    the ledger.
+ * @return            Zero on success, -1 on error.
+ */
+int update_ledger(const struct stat* attr, const struct replay* state, struct timespec* duration);
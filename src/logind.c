@@ -0,0 +1,323 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "logind.h"
+#include "source.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utmpx.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+
+
+/**
+ * The size of the buffer used to read a session
+ * file. Longer files are truncated, the fields that
+ * are used are written early in the file.
+ */
+#define SESSION_FILE_SIZE  4096
+
+
+
+/**
+ * Get the value of a field in a session file.
+ * 
+ * @param   text  The content of the session file.
+ * @param   key   The name of the field followed by a '='.
+ * @param   len   Output parameter for the length of the value.
+ * @return        The value, not NUL-terminated, `NULL` if missing.
+ */
+static const char* get_field(const char* text, const char* key, size_t* len)
+{
+  size_t keylen = strlen(key);
+  const char* end;
+  
+  for (; text && *text; text = strchr(text, '\n'), text = text ? text + 1 : NULL)
+    if (!strncmp(text, key, keylen))
+      {
+	text += keylen;
+	end = strchrnul(text, '\n');
+	*len = (size_t)(end - text);
+	return text;
+      }
+  return NULL;
+}
+
+
+/**
+ * Check whether a field in a session file has a specific value.
+ * 
+ * @param   text   The content of the session file.
+ * @param   key    The name of the field followed by a '='.
+ * @param   value  The value.
+ * @return         1 if the field has the value, 0 otherwise.
+ */
+static int field_is(const char* text, const char* key, const char* value)
+{
+  size_t len;
+  text = get_field(text, key, &len);
+  return text && (len == strlen(value)) && !strncmp(text, value, len);
+}
+
+
+/**
+ * Read a session file.
+ * 
+ * @param   dirfd  File descriptor for the session directory.
+ * @param   name   The name of the session file.
+ * @param   buf    Buffer of `SESSION_FILE_SIZE` bytes,
+ *                 will be NUL-terminated.
+ * @return         Zero on success, 1 if the file shall
+ *                 be ignored, -1 on error.
+ */
+static int read_session(int dirfd, const char* name, char* buf)
+{
+  struct stat attr;
+  size_t have = 0;
+  ssize_t got;
+  int fd, saved_errno;
+  
+  /* The directory also holds FIFO:s named "ID.ref" and
+   * temporary files named ".#IDXXXXXX", so do not block
+   * on open, and only read regular files. */
+  fd = openat(dirfd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY);
+  if (fd == -1)
+    return errno == ENOENT ? 1 : -1; /* The session may have just ended. */
+  if (fstat(fd, &attr))
+    goto fail;
+  if (!S_ISREG(attr.st_mode))
+    {
+      close(fd);
+      return 1;
+    }
+  
+  while (have < SESSION_FILE_SIZE - 1)
+    {
+      got = read(fd, buf + have, SESSION_FILE_SIZE - 1 - have);
+      if (got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  goto fail;
+	}
+      if (got == 0)
+	break;
+      have += (size_t)got;
+    }
+  buf[have] = '\0';
+  
+  close(fd);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Get the time the set of sessions, in the directory specified
+ * by the environment variable AUTOHALTD_LOGIND, last changed.
+ * 
+ * @param   changed  Output parameter for the time. Set to zero if
+ *                   AUTOHALTD_LOGIND is not set, or logind is not running.
+ * @return           Zero on success, -1 on error.
+ */
+int get_logind_change_time(struct timespec* changed)
+{
+  const char* path = getenv("AUTOHALTD_LOGIND");
+  struct stat attr;
+  
+  memset(changed, 0, sizeof(*changed));
+  if ((path == NULL) || (*path == '\0'))
+    return 0;
+  
+  /* Files are replaced by rename(2) when updated and
+   * removed when the session ends, either updates the
+   * directory's modification time. */
+  if (stat(path, &attr))
+    return errno == ENOENT ? 0 : -1; /* logind is not running. */
+  *changed = attr.st_mtim;
+  return 0;
+}
+
+
+/**
+ * Count the user sessions that systemd-logind(8) reports
+ * as online or active, in the directory specified by the
+ * environment variable AUTOHALTD_LOGIND. Sessions on a
+ * terminal that is already known to have an active login
+ * are not counted. This catches graphical logins, that
+ * display managers do not necessarily record in utmp.
+ * 
+ * @param   known      Logins from utmp.
+ * @param   active     For each element in `known`, positive
+ *                     if the login is active.
+ * @param   n          The number of elements in `known`.
+ * @param   skip_seat  Whether local sessions on a seat
+ *                     shall not be counted.
+ * @return             The number of sessions, -1 on error.
+ */
+int count_logind_sessions(const struct utmpx* known, const signed char* active, size_t n, int skip_seat)
+{
+  const char* path = getenv("AUTOHALTD_LOGIND");
+  char buf[SESSION_FILE_SIZE];
+  struct dirent* f;
+  const char* tty;
+  size_t i, len;
+  DIR* dir = NULL;
+  int r, rc = 0, saved_errno;
+  
+  if ((path == NULL) || (*path == '\0'))
+    return 0;
+  
+  dir = opendir(path);
+  if (dir == NULL)
+    return errno == ENOENT ? 0 : -1; /* logind is not running. */
+  
+  for (errno = 0; (f = readdir(dir)); errno = 0)
+    {
+      if (strchr(f->d_name, '.'))
+	continue;
+      r = read_session(dirfd(dir), f->d_name, buf);
+      if (r < 0)
+	goto fail;
+      if (r > 0)
+	continue;
+      
+      if (!field_is(buf, "CLASS=", "user"))
+	continue; /* For example a greeter. */
+      if (!field_is(buf, "STATE=", "active") && !field_is(buf, "STATE=", "online"))
+	continue; /* For example closing, lingering processes are not a login. */
+      if (skip_seat && !field_is(buf, "REMOTE=", "1") && get_field(buf, "SEAT=", &len) && len)
+	continue; /* The input devices tell whether it is used. */
+      
+      /* Already counted? */
+      tty = get_field(buf, "TTY=", &len);
+      i = n;
+      if (tty && len && (len <= sizeof(known->ut_line)))
+	for (i = 0; i < n; i++)
+	  if ((active[i] > 0) && !strncmp(known[i].ut_line, tty, len) &&
+	      ((len == sizeof(known->ut_line)) || !known[i].ut_line[len]))
+	    break;
+      if (i < n)
+	continue;
+      
+#ifdef DEBUG
+      fprintf(stderr, "logind session: %s\n", f->d_name);
+#endif
+      if (rc < INT_MAX)
+	rc++;
+    }
+  if (errno)
+    goto fail;
+  
+ done:
+  saved_errno = errno;
+  closedir(dir);
+  errno = saved_errno;
+  return rc;
+  
+ fail:
+  rc = -1;
+  goto done;
+}
+
+
+/**
+ * Watch the session directory, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int logind_open(int epfd, unsigned index)
+{
+  const char* path = getenv("AUTOHALTD_LOGIND");
+  struct epoll_event ev;
+  int fd, saved_errno;
+  
+  if ((path == NULL) || (*path == '\0'))
+    return 0;
+  
+  /* A session is replaced by rename(2) when it starts to close,
+   * and is removed when it has closed. Either way, the idle
+   * time shall be counted from then. */
+  fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (fd < 0)
+    return -1;
+  if (inotify_add_watch(fd, path, IN_DELETE | IN_MOVED_TO) < 0)
+    {
+      close(fd);
+      return errno == ENOENT ? 0 : -1; /* logind is not running. */
+    }
+  ev.events = EPOLLIN;
+  ev.data.u64 = SOURCE_DATA(index, fd);
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+    {
+      saved_errno = errno;
+      close(fd);
+      errno = saved_errno;
+      return -1;
+    }
+  return 0;
+}
+
+
+/**
+ * Handle a change in the session directory, see `struct source`.
+ * 
+ * @param   epfd    The epoll(7) instance.
+ * @param   index   The index of the source.
+ * @param   fd      The file descriptor.
+ * @param   events  The epoll(7) events.
+ * @return          1, the machine shall be checked now.
+ */
+static int logind_handle(int epfd, unsigned index, int fd, uint32_t events)
+{
+  (void) epfd;
+  (void) index;
+  (void) fd;
+  (void) events;
+  return 1;
+}
+
+
+/**
+ * Activity source that requests a check when
+ * a session in the directory specified by the
+ * environment variable AUTOHALTD_LOGIND ends.
+ */
+const struct source logind_source = {
+  .open   = logind_open,
+  .handle = logind_handle,
+  .tick   = NULL,
+  .save   = NULL,
+};
+
@@ -0,0 +1,59 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct utmpx;
+struct source;
+
+
+
+/**
+ * Get the time the set of sessions, in the directory specified
+ * by the environment variable AUTOHALTD_LOGIND, last changed.
+ * 
+ * @param   changed  Output parameter for the time. Set to zero if
+ *                   AUTOHALTD_LOGIND is not set, or logind is not running.
+ * @return           Zero on success, -1 on error.
+ */
+int get_logind_change_time(struct timespec* changed);
+
+/**
+ * Count the user sessions that systemd-logind(8) reports
+ * as online or active, in the directory specified by the
+ * environment variable AUTOHALTD_LOGIND. Sessions on a
+ * terminal that is already known to have an active login
+ * are not counted. This catches graphical logins, that
+ * display managers do not necessarily record in utmp.
+ * 
+ * @param   known      Logins from utmp.
+ * @param   active     For each element in `known`, positive
+ *                     if the login is active.
+ * @param   n          The number of elements in `known`.
+ * @param   skip_seat  Whether local sessions on a seat
+ *                     shall not be counted.
+ * @return             The number of sessions, -1 on error.
+ */
+int count_logind_sessions(const struct utmpx* known, const signed char* active, size_t n, int skip_seat);
+
+/**
+ * Activity source that requests a check when
+ * a session in the directory specified by the
+ * environment variable AUTOHALTD_LOGIND ends.
+ */
+extern const struct source logind_source;
+
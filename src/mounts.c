@@ -0,0 +1,375 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "mounts.h"
+#include "source.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * The fanotify(7) instance, -1 if the
+ * mounts are not being watched.
+ */
+static int watch = -1;
+
+/**
+ * The time of the last write, per `CLOCK_REALTIME`,
+ * 0 if there has not been any.
+ */
+static time_t last_write = 0;
+
+/**
+ * The time, per `CLOCK_MONOTONIC`, when the mounts
+ * shall be watched again, 0 if they are watched.
+ */
+static time_t rearm_time = 0;
+
+
+
+/**
+ * Get how long it has been since the last write to the
+ * watched mounts, as recorded by `mounts_source` in the
+ * environment variable AUTOHALTD_MOUNTS_LAST.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of
+ *                seconds since the last write.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_MOUNTS
+ *                or AUTOHALTD_MOUNTS_LAST is not set.
+ */
+int get_mounts_idle_time(time_t now, unsigned long long int* idle)
+{
+  const char* list = getenv("AUTOHALTD_MOUNTS");
+  const char* last = getenv("AUTOHALTD_MOUNTS_LAST");
+  time_t t;
+  
+  if (!list || !*list || !last || !*last)
+    return 0;
+  t = (time_t)atoll(last);
+  *idle = (now > t) ? (unsigned long long int)(now - t) : 0;
+  return 1;
+}
+
+
+/**
+ * Discard the queued events. Only whether there were any
+ * is looked at, but each event comes with a file descriptor
+ * for the file, that must be closed.
+ * 
+ * @return  1 if there was any event, 0 otherwise.
+ */
+static int drain(void)
+{
+  union
+  {
+    struct fanotify_event_metadata event;
+    char buf[4096];
+  } u;
+  const struct fanotify_event_metadata* e;
+  ssize_t n;
+  int any = 0;
+  
+  while ((n = read(watch, u.buf, sizeof(u.buf))) > 0)
+    for (e = &u.event; FAN_EVENT_OK(e, n); e = FAN_EVENT_NEXT(e, n))
+      {
+	any = 1;
+	if (e->fd >= 0)
+	  close(e->fd);
+      }
+  return any;
+}
+
+
+/**
+ * Record that there has been a write.
+ */
+static void record_write(void)
+{
+  struct timespec now;
+  if (!clock_now(CLOCK_REALTIME, &now))
+    last_write = now.tv_sec;
+}
+
+
+/**
+ * Check whether a path is the root of a mount.
+ * fanotify(7) would otherwise mark the mount that
+ * contains it.
+ * 
+ * @param   path  The path.
+ * @return        1 if it is, 0 if it is not, or if it does
+ *                not exist, -1 on error.
+ */
+static int is_mount_root(const char* path)
+{
+  struct statx attr, parent;
+  char* up;
+  int r;
+  
+  if (statx(AT_FDCWD, path, 0, STATX_TYPE | STATX_INO, &attr))
+    return ((errno == ENOENT) || (errno == ENOTDIR)) ? 0 : -1;
+  if (attr.stx_attributes_mask & STATX_ATTR_MOUNT_ROOT)
+    return !!(attr.stx_attributes & STATX_ATTR_MOUNT_ROOT);
+  
+  /* Before Linux 5.8, see whether the parent directory is on
+   * another device, or is the same directory, as for /. */
+  if (!S_ISDIR(attr.stx_mode))
+    return 0;
+  up = malloc(strlen(path) + sizeof("/.."));
+  if (up == NULL)
+    return -1;
+  stpcpy(stpcpy(up, path), "/..");
+  r = statx(AT_FDCWD, up, 0, STATX_INO, &parent);
+  free(up);
+  if (r)
+    return -1;
+  return ((attr.stx_dev_major != parent.stx_dev_major) ||
+	  (attr.stx_dev_minor != parent.stx_dev_minor) ||
+	  (attr.stx_ino == parent.stx_ino));
+}
+
+
+/**
+ * Call a function for each mount in a comma-separated list.
+ * 
+ * @param   list  The list.
+ * @param   f     The function, which is given the path of the
+ *                mount, and returns non-zero to stop the iteration.
+ * @return        The first non-zero value returned by `f`, zero if
+ *                none, -1 on error.
+ */
+static int for_each_mount(const char* list, int (*f)(const char* path))
+{
+  const char* end;
+  char* path;
+  int r;
+  
+  for (;; list = end + 1)
+    {
+      end = strchrnul(list, ',');
+      if (end != list)
+	{
+	  path = strndup(list, (size_t)(end - list));
+	  if (path == NULL)
+	    return -1;
+	  r = f(path);
+	  free(path);
+	  if (r)
+	    return r;
+	}
+      if (*end == '\0')
+	return 0;
+    }
+}
+
+
+/**
+ * Check that a mount is the root of a mount, see `check_mounts`.
+ * 
+ * @param   path  The path of the mount.
+ * @return        0 if it is, 1 if it is not, -1 on error.
+ */
+static int check_mount(const char* path)
+{
+  int r = is_mount_root(path);
+  return r < 0 ? -1 : !r;
+}
+
+
+/**
+ * Check that each path in a comma-separated list of mounts,
+ * as for the environment variable AUTOHALTD_MOUNTS, exists,
+ * and is the root of a mount.
+ * 
+ * @param   list  The list.
+ * @return        1 if they are, 0 if any is not, -1 on error.
+ */
+int check_mounts(const char* list)
+{
+  int r = for_each_mount(list, check_mount);
+  return r < 0 ? -1 : !r;
+}
+
+
+/**
+ * Put a mark on a mount, see `mark_mounts`.
+ * 
+ * @param   path  The path of the mount.
+ * @return        Zero on success, -1 on error.
+ */
+static int mark_mount(const char* path)
+{
+  int r = is_mount_root(path);
+  if (r <= 0)
+    return r; /* It has been unmounted, perhaps to be mounted again. */
+  return fanotify_mark(watch, FAN_MARK_ADD | FAN_MARK_MOUNT, (uint64_t)(FAN_MODIFY | FAN_CLOSE_WRITE), AT_FDCWD, path);
+}
+
+
+/**
+ * Put a mark on each mount listed in the environment
+ * variable AUTOHALTD_MOUNTS. Paths that are not, or are
+ * no longer, the roots of mounts are skipped.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int mark_mounts(void)
+{
+  return for_each_mount(getenv("AUTOHALTD_MOUNTS"), mark_mount);
+}
+
+
+/**
+ * Start watching the mounts, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int mounts_open(int epfd, unsigned index)
+{
+  const char* list = getenv("AUTOHALTD_MOUNTS");
+  const char* last = getenv("AUTOHALTD_MOUNTS_LAST");
+  struct epoll_event ev;
+  int saved_errno;
+  
+  if ((list == NULL) || (*list == '\0'))
+    return 0;
+  if (last && *last)
+    last_write = (time_t)atoll(last);
+  
+  /* Writes are only noticed, never vetoed, so merely notify. */
+  watch = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+  if (watch < 0)
+    return -1;
+  if (mark_mounts())
+    goto fail;
+  ev.events = EPOLLIN;
+  ev.data.u64 = SOURCE_DATA(index, watch);
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, watch, &ev))
+    goto fail;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(watch);
+  watch = -1;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Handle writes, see `struct source`.
+ * 
+ * @param   epfd    The epoll(7) instance.
+ * @param   index   The index of the source.
+ * @param   fd      The file descriptor.
+ * @param   events  The epoll(7) events.
+ * @return          0 on success, -1 on error.
+ */
+static int mounts_handle(int epfd, unsigned index, int fd, uint32_t events)
+{
+  struct timespec now;
+  
+  (void) epfd;
+  (void) index;
+  (void) fd;
+  (void) events;
+  
+  if (!drain())
+    return 0;
+  record_write();
+  
+  /* Remove the marks for a while, rather than letting the events
+   * of a burst of writes queue up, and each open the file it is
+   * about, and mark the mounts again when the while is over. */
+  if (fanotify_mark(watch, FAN_MARK_FLUSH | FAN_MARK_MOUNT, (uint64_t)0, AT_FDCWD, NULL))
+    return -1;
+  drain();
+  if (clock_now(CLOCK_MONOTONIC, &now))
+    return -1;
+  rearm_time = now.tv_sec + AUTOHALTD_MOUNTS_COALESCE;
+  return 0;
+}
+
+
+/**
+ * Mark the mounts again, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @param   now    The time, per `CLOCK_MONOTONIC`.
+ * @return         The number of seconds until this function
+ *                 shall be called again, 0 if it need not be called.
+ */
+static time_t mounts_tick(int epfd, unsigned index, time_t now)
+{
+  (void) epfd;
+  (void) index;
+  
+  if (!rearm_time)
+    return 0;
+  if (now < rearm_time)
+    return rearm_time - now;
+  
+  rearm_time = 0;
+  if (mark_mounts())
+    perror("autohaltd-sleep");
+  return 0;
+}
+
+
+/**
+ * Store the time of the last write in the
+ * environment, see `struct source`.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int mounts_save(void)
+{
+  char envval[3 * sizeof(long long int) + 2];
+  if ((watch < 0) || !last_write)
+    return 0;
+  sprintf(envval, "%lli", (long long int)last_write);
+  return setenv("AUTOHALTD_MOUNTS_LAST", envval, 1);
+}
+
+
+/**
+ * Activity source that records the time of the last
+ * write to a file on any of the mounts listed, separated
+ * by commas, in the environment variable AUTOHALTD_MOUNTS.
+ */
+const struct source mounts_source = {
+  .open   = mounts_open,
+  .handle = mounts_handle,
+  .tick   = mounts_tick,
+  .save   = mounts_save,
+};
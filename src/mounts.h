@@ -0,0 +1,52 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct source;
+
+
+
+/**
+ * Get how long it has been since the last write to the
+ * watched mounts, as recorded by `mounts_source` in the
+ * environment variable AUTOHALTD_MOUNTS_LAST.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of
+ *                seconds since the last write.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_MOUNTS
+ *                or AUTOHALTD_MOUNTS_LAST is not set.
+ */
+int get_mounts_idle_time(time_t now, unsigned long long int* idle);
+
+/**
+ * Check that each path in a comma-separated list of mounts,
+ * as for the environment variable AUTOHALTD_MOUNTS, exists,
+ * and is the root of a mount.
+ * 
+ * @param   list  The list.
+ * @return        1 if they are, 0 if any is not, -1 on error.
+ */
+int check_mounts(const char* list);
+
+/**
+ * Activity source that records the time of the last
+ * write to a file on any of the mounts listed, separated
+ * by commas, in the environment variable AUTOHALTD_MOUNTS.
+ */
+extern const struct source mounts_source;
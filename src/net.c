@@ -0,0 +1,373 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "net.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+/**
+ * The size of the buffer used to read the socket tables.
+ * Must be larger than any line in the tables.
+ */
+#ifndef NET_BUFFER_SIZE
+# define NET_BUFFER_SIZE  ((size_t)64 << 10)
+#endif
+
+/**
+ * The state of an established TCP connection,
+ * as listed in /proc/net/tcp.
+ */
+#define TCP_ESTABLISHED_STATE  0x01
+
+/**
+ * The state of a connected UNIX domain socket,
+ * as listed in /proc/net/unix.
+ */
+#define UNIX_CONNECTED_STATE  0x03
+
+
+
+/**
+ * The connections to keep the machine up for.
+ */
+struct connections
+{
+  /**
+   * Bitset of TCP ports, bit `port % 8` in
+   * byte `port / 8` is set if `port` is listed.
+   */
+  uint8_t ports[(UINT16_MAX + 1) / 8];
+  
+  /**
+   * The pathnames of the UNIX domain sockets. Not
+   * NUL-terminated, they end at a comma or a NUL.
+   */
+  const char** paths;
+  
+  /**
+   * The number of elements in `paths`.
+   */
+  size_t npaths;
+  
+  /**
+   * The number of listed ports and ranges of ports.
+   */
+  size_t nranges;
+};
+
+
+
+/**
+ * Parse an unsigned hexadecimal number.
+ * 
+ * @param   p  The text to parse, will be updated to point
+ *             to the first character after the number.
+ * @return     The parsed number.
+ */
+static unsigned long int parse_hex(const char** p)
+{
+  static const signed char digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  };
+  const unsigned char* s = (const unsigned char*)*p;
+  unsigned long int value = 0;
+  for (; digits[*s]; s++)
+    value = (value << 4) | (unsigned long int)(digits[*s] - 1);
+  *p = (const char*)s;
+  return value;
+}
+
+
+/**
+ * Skip a number of space-separated fields.
+ * 
+ * @param   p  The text, will be updated to point to the
+ *             first character in the field after the
+ *             skipped fields.
+ * @param   n  The number of fields to skip.
+ */
+static void skip_fields(const char** p, int n)
+{
+  const char* s = *p;
+  while (*s == ' ')
+    s++;
+  while (n--)
+    {
+      while (*s && (*s != ' ') && (*s != '\n'))
+	s++;
+      while (*s == ' ')
+	s++;
+    }
+  *p = s;
+}
+
+
+/**
+ * Check whether a line in /proc/net/tcp or
+ * /proc/net/tcp6 lists a listed connection.
+ * 
+ * @param   c     The connections.
+ * @param   line  The line.
+ * @return        1 if it lists a listed connection, 0 otherwise.
+ */
+static int match_tcp(const struct connections* c, const char* line)
+{
+  unsigned long int local, remote;
+  
+  /* "sl: local_address:port rem_address:port st ..." */
+  skip_fields(&line, 1);
+  line = strchr(line, ':');
+  if (line == NULL)
+    return 0;
+  line++;
+  local = parse_hex(&line);
+  skip_fields(&line, 0);
+  line = strchr(line, ':');
+  if (line == NULL)
+    return 0;
+  line++;
+  remote = parse_hex(&line);
+  skip_fields(&line, 0);
+  if (parse_hex(&line) != TCP_ESTABLISHED_STATE)
+    return 0;
+  
+  local &= UINT16_MAX, remote &= UINT16_MAX;
+  return ((c->ports[local / 8] >> (local % 8)) & 1) || ((c->ports[remote / 8] >> (remote % 8)) & 1);
+}
+
+
+/**
+ * Check whether a line in /proc/net/unix
+ * lists a listed connection.
+ * 
+ * @param   c     The connections.
+ * @param   line  The line.
+ * @return        1 if it lists a listed connection, 0 otherwise.
+ */
+static int match_unix(const struct connections* c, const char* line)
+{
+  const char* end;
+  size_t i, len;
+  
+  /* "Num: RefCount Protocol Flags Type St Inode Path" */
+  skip_fields(&line, 5);
+  if (parse_hex(&line) != UNIX_CONNECTED_STATE)
+    return 0;
+  skip_fields(&line, 1);
+  if (*line != '/')
+    return 0;
+  end = strchr(line, '\n');
+  len = end ? (size_t)(end - line) : strlen(line);
+  
+  for (i = 0; i < c->npaths; i++)
+    if (!strncmp(c->paths[i], line, len) && (c->paths[i][len] == ',' || c->paths[i][len] == '\0'))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Check whether any line in a socket table
+ * lists a listed connection.
+ * 
+ * @param   c      The connections.
+ * @param   path   The pathname of the socket table.
+ * @param   match  Function that checks a line.
+ * @param   buf    Buffer of `NET_BUFFER_SIZE` bytes.
+ * @return         1 if a listed connection is listed,
+ *                 0 otherwise, -1 on error.
+ */
+static int scan_table(const struct connections* c, const char* path,
+		      int (*match)(const struct connections* c, const char* line), char* buf)
+{
+  size_t have = 0;
+  ssize_t got;
+  char* line;
+  char* end;
+  int fd, first = 1, rc = 0, saved_errno;
+  
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return errno == ENOENT ? 0 : -1; /* For example, IPv6 is not supported. */
+  
+  for (;;)
+    {
+      got = read(fd, buf + have, NET_BUFFER_SIZE - 1 - have);
+      if (got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  rc = -1;
+	  break;
+	}
+      if (got == 0)
+	break;
+      have += (size_t)got;
+      buf[have] = '\0';
+      
+      /* Look at each complete line. */
+      for (line = buf; (end = memchr(line, '\n', have - (size_t)(line - buf))); line = end + 1)
+	{
+	  if (first)
+	    first = 0; /* Skip the heading. */
+	  else if (match(c, line))
+	    {
+	      rc = 1;
+	      goto done;
+	    }
+	}
+      
+      /* Keep the incomplete last line for the next read. */
+      have -= (size_t)(line - buf);
+      memmove(buf, line, have);
+    }
+  
+ done:
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Parse a list of connections.
+ * 
+ * @param   str  A comma-separated list of TCP port numbers,
+ *               ranges of TCP port numbers, and absolute
+ *               pathnames of UNIX domain sockets.
+ * @param   c    Output parameter for the connections,
+ *               `NULL` to only validate `str`. `c->paths`
+ *               must be freed by the caller.
+ * @return       Zero on success, -1 on error.
+ */
+static int parse(const char* str, struct connections* c)
+{
+  unsigned long int first, last;
+  char* end;
+  void* new;
+  
+  if (c)
+    memset(c, 0, sizeof(*c));
+  
+  for (;;)
+    {
+      if (*str == '/')
+	{
+	  if (c)
+	    {
+	      new = realloc(c->paths, (c->npaths + 1) * sizeof(*c->paths));
+	      if (new == NULL)
+		return -1;
+	      c->paths = new;
+	      c->paths[c->npaths++] = str;
+	    }
+	  str = strchrnul(str, ',');
+	}
+      else
+	{
+	  if ((*str < '0') || ('9' < *str))
+	    return errno = EINVAL, -1;
+	  first = last = strtoul(str, &end, 10);
+	  if (*end == '-')
+	    {
+	      if ((end[1] < '0') || ('9' < end[1]))
+		return errno = EINVAL, -1;
+	      last = strtoul(end + 1, &end, 10);
+	    }
+	  if ((last > UINT16_MAX) || (first > last) || (*end && (*end != ',')))
+	    return errno = EINVAL, -1;
+	  str = end;
+	  if (c)
+	    for (c->nranges++; first <= last; first++)
+	      c->ports[first / 8] |= (uint8_t)(1 << (first % 8));
+	}
+      if (*str == '\0')
+	return 0;
+      str++;
+    }
+}
+
+
+/**
+ * Validate a list of connections to keep the machine up for.
+ * 
+ * @param   str  A comma-separated list of TCP port numbers,
+ *               ranges of TCP port numbers, such as "6000-6063",
+ *               and absolute pathnames of UNIX domain sockets.
+ * @return       Zero if valid, -1 if invalid.
+ */
+int parse_connections(const char* str)
+{
+  return parse(str, NULL);
+}
+
+
+/**
+ * Check whether any of the connections listed in the
+ * environment variable AUTOHALTD_CONNECTIONS, in the
+ * format accepted by `parse_connections`, is established.
+ * 
+ * @return  1 if a connection is established, 0 if none is
+ *          established or if AUTOHALTD_CONNECTIONS is not
+ *          set, -1 on error.
+ */
+int have_connections(void)
+{
+  const char* str = getenv("AUTOHALTD_CONNECTIONS");
+  struct connections* c = NULL;
+  char* buf = NULL;
+  int rc = -1, saved_errno;
+  
+  if ((str == NULL) || (*str == '\0'))
+    return 0;
+  
+  c = malloc(sizeof(*c));
+  buf = malloc(NET_BUFFER_SIZE);
+  if ((c == NULL) || (buf == NULL) || parse(str, c))
+    goto done;
+  
+  rc = 0;
+  if (c->nranges && !rc)
+    rc = scan_table(c, PROCDIR "/net/tcp", match_tcp, buf);
+  if (c->nranges && !rc)
+    rc = scan_table(c, PROCDIR "/net/tcp6", match_tcp, buf);
+  if (c->npaths && !rc)
+    rc = scan_table(c, PROCDIR "/net/unix", match_unix, buf);
+  
+ done:
+  saved_errno = errno;
+  if (c)
+    free(c->paths);
+  free(c);
+  free(buf);
+  errno = saved_errno;
+  return rc;
+}
+
@@ -0,0 +1,39 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Validate a list of connections to keep the machine up for.
+ * 
+ * @param   str  A comma-separated list of TCP port numbers,
+ *               ranges of TCP port numbers, such as "6000-6063",
+ *               and absolute pathnames of UNIX domain sockets.
+ * @return       Zero if valid, -1 if invalid.
+ */
+int parse_connections(const char* str);
+
+/**
+ * Check whether any of the connections listed in the
+ * environment variable AUTOHALTD_CONNECTIONS, in the
+ * format accepted by `parse_connections`, is established.
+ * 
+ * @return  1 if a connection is established, 0 if none is
+ *          established or if AUTOHALTD_CONNECTIONS is not
+ *          set, -1 on error.
+ */
+int have_connections(void);
+
@@ -0,0 +1,265 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "notify.h"
+#include "source.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+
+
+/**
+ * The number of open sessions, as far as
+ * pam_autohalt.so has told.
+ */
+static unsigned long long int sessions = 0;
+
+/**
+ * The time, per `CLOCK_REALTIME`, the last session
+ * was closed, 0 if none has been closed.
+ */
+static time_t closed_time = 0;
+
+/**
+ * Timer that expires when the machine shall be checked
+ * after the last session was closed, -1 if not created.
+ */
+static int settle = -1;
+
+
+
+/**
+ * Create the socket that pam_autohalt.so notifies when
+ * sessions are opened and closed, and store its file
+ * descriptor, which is inherited through the exec chain,
+ * in the environment variable AUTOHALTD_NOTIFY_FD.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+int open_notify_socket(void)
+{
+  struct sockaddr_un addr;
+  char envval[3 * sizeof(int) + 2];
+  mode_t old_umask;
+  int fd, r, saved_errno;
+  
+  if (strlen(AUTOHALTD_NOTIFY_PATHNAME) >= sizeof(addr.sun_path))
+    return errno = ENAMETOOLONG, -1;
+  
+  fd = socket(PF_UNIX, SOCK_DGRAM, 0);
+  if (fd == -1)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, AUTOHALTD_NOTIFY_PATHNAME);
+  unlink(AUTOHALTD_NOTIFY_PATHNAME); /* Left by an earlier instance. */
+  /* Sessions are opened and closed by privileged processes. The daemon
+   * runs with umask 0, so the socket must not be created writable by
+   * all, even until it is chmod:ed. */
+  old_umask = umask(077);
+  r = bind(fd, (void*)&addr, (socklen_t)sizeof(addr));
+  umask(old_umask);
+  if (r)
+    goto fail;
+  if (chmod(AUTOHALTD_NOTIFY_PATHNAME, 0600))
+    goto fail;
+  
+  sprintf(envval, "%i", fd);
+  if (setenv("AUTOHALTD_NOTIFY_FD", envval, 1))
+    goto fail;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Get the time the last session was closed, as recorded
+ * by `notify_source` in the environment variable
+ * AUTOHALTD_SESSION_CLOSED.
+ * 
+ * @param   closed  Output parameter for the time. Set to zero
+ *                  if no session has been closed.
+ * @return          Zero on success, -1 on error.
+ */
+int get_session_close_time(struct timespec* closed)
+{
+  const char* last = getenv("AUTOHALTD_SESSION_CLOSED");
+  memset(closed, 0, sizeof(*closed));
+  if (last && *last)
+    closed->tv_sec = (time_t)atoll(last);
+  return 0;
+}
+
+
+/**
+ * Start listening for notifications, if the
+ * socket has been created, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int notify_open(int epfd, unsigned index)
+{
+  const char* fd = getenv("AUTOHALTD_NOTIFY_FD");
+  const char* value;
+  struct epoll_event ev;
+  
+  if ((fd == NULL) || (*fd == '\0'))
+    return 0;
+  
+  value = getenv("AUTOHALTD_SESSIONS");
+  sessions = value ? (unsigned long long int)atoll(value) : 0;
+  value = getenv("AUTOHALTD_SESSION_CLOSED");
+  closed_time = value ? (time_t)atoll(value) : 0;
+  
+  ev.events = EPOLLIN;
+  ev.data.u64 = SOURCE_DATA(index, atoi(fd));
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, atoi(fd), &ev);
+}
+
+
+/**
+ * Start the timer that requests a check after the last
+ * session was closed.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int arm_settle_timer(int epfd, unsigned index)
+{
+  struct itimerspec timeout;
+  struct epoll_event ev;
+  
+  if (settle < 0)
+    {
+      settle = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+      if (settle < 0)
+	return -1;
+      ev.events = EPOLLIN;
+      ev.data.u64 = SOURCE_DATA(index, settle);
+      if (epoll_ctl(epfd, EPOLL_CTL_ADD, settle, &ev))
+	return -1;
+    }
+  memset(&timeout, 0, sizeof(timeout));
+  timeout.it_value.tv_sec = AUTOHALTD_NOTIFY_SETTLE;
+  return timerfd_settime(settle, 0, &timeout, NULL);
+}
+
+
+/**
+ * Handle notifications, see `struct source`.
+ * 
+ * @param   epfd    The epoll(7) instance.
+ * @param   index   The index of the source.
+ * @param   fd      The file descriptor.
+ * @param   events  The epoll(7) events.
+ * @return          1 if the machine shall be checked now,
+ *                  0 otherwise, -1 on error.
+ */
+static int notify_handle(int epfd, unsigned index, int fd, uint32_t events)
+{
+  struct timespec now;
+  char buf[64];
+  ssize_t n;
+  int last = 0;
+  
+  (void) events;
+  
+  if (fd == settle)
+    return 1;
+  
+  while ((n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) >= 0)
+    {
+      buf[n] = '\0';
+      if (!strcmp(buf, "open"))
+	sessions++;
+      else if (!strcmp(buf, "close"))
+	{
+	  /* Sessions opened before autohaltd started are
+	   * not counted, so the count cannot be trusted to
+	   * reach zero exactly when the last one closes. */
+	  if (sessions)
+	    sessions--;
+	  last = !sessions;
+	  if (clock_now(CLOCK_REALTIME, &now))
+	    return -1;
+	  closed_time = now.tv_sec;
+	}
+    }
+  if ((errno != EAGAIN) && (errno != EINTR))
+    return -1;
+  
+  /* The login may not have been recorded as ended in utmp
+   * yet, so check a moment later, rather than at once. */
+  if (last && arm_settle_timer(epfd, index))
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Store the number of sessions, and the time the
+ * last one was closed, in the environment, see
+ * `struct source`.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int notify_save(void)
+{
+  char envval[3 * sizeof(long long int) + 2];
+  const char* fd = getenv("AUTOHALTD_NOTIFY_FD");
+  if ((fd == NULL) || (*fd == '\0'))
+    return 0;
+  sprintf(envval, "%llu", sessions);
+  if (setenv("AUTOHALTD_SESSIONS", envval, 1))
+    return -1;
+  if (closed_time == 0)
+    return 0;
+  sprintf(envval, "%lli", (long long int)closed_time);
+  return setenv("AUTOHALTD_SESSION_CLOSED", envval, 1);
+}
+
+
+/**
+ * Activity source that counts the sessions pam_autohalt.so
+ * has notified about, and requests a check shortly after
+ * the last one is closed.
+ */
+const struct source notify_source = {
+  .open   = notify_open,
+  .handle = notify_handle,
+  .tick   = NULL,
+  .save   = notify_save,
+};
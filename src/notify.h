@@ -0,0 +1,50 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct source;
+
+
+
+/**
+ * Create the socket that pam_autohalt.so notifies when
+ * sessions are opened and closed, and store its file
+ * descriptor, which is inherited through the exec chain,
+ * in the environment variable AUTOHALTD_NOTIFY_FD.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+int open_notify_socket(void);
+
+/**
+ * Get the time the last session was closed, as recorded
+ * by `notify_source` in the environment variable
+ * AUTOHALTD_SESSION_CLOSED.
+ * 
+ * @param   closed  Output parameter for the time. Set to zero
+ *                  if no session has been closed.
+ * @return          Zero on success, -1 on error.
+ */
+int get_session_close_time(struct timespec* closed);
+
+/**
+ * Activity source that counts the sessions pam_autohalt.so
+ * has notified about, and requests a check shortly after
+ * the last one is closed.
+ */
+extern const struct source notify_source;
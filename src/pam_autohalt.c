@@ -0,0 +1,99 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#define PAM_SM_SESSION
+#include "common.h"
+
+#include <security/pam_modules.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+
+/**
+ * Tell autohaltd that a session has been opened or closed.
+ * 
+ * Failure is ignored: autohaltd may not be running, and
+ * utmp remains the authority on who is logged in, so
+ * nothing is lost but a prompt wake-up.
+ * 
+ * @param  message  "open" or "close".
+ * @param  argc     The number of module arguments.
+ * @param  argv     The module arguments, "socket=PATH"
+ *                  selects the socket autohaltd listens on.
+ */
+static void notify(const char* message, int argc, const char** argv)
+{
+  const char* path = AUTOHALTD_NOTIFY_PATHNAME;
+  struct sockaddr_un addr;
+  int i, fd;
+  
+  for (i = 0; i < argc; i++)
+    if (!strncmp(argv[i], "socket=", sizeof("socket=") - 1))
+      path = argv[i] + 7;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return;
+  
+  fd = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  /* Never hold up the login on autohaltd. */
+  sendto(fd, message, strlen(message), MSG_DONTWAIT, (void*)&addr, (socklen_t)sizeof(addr));
+  close(fd);
+}
+
+
+/**
+ * Called by PAM when a session is opened.
+ * 
+ * @param   pamh   The PAM handle, unused.
+ * @param   flags  PAM flags, unused.
+ * @param   argc   The number of module arguments.
+ * @param   argv   The module arguments.
+ * @return         `PAM_SUCCESS`.
+ */
+PAM_EXTERN int pam_sm_open_session(pam_handle_t* pamh, int flags, int argc, const char** argv)
+{
+  (void) pamh;
+  (void) flags;
+  notify("open", argc, argv);
+  return PAM_SUCCESS;
+}
+
+
+/**
+ * Called by PAM when a session is closed.
+ * 
+ * @param   pamh   The PAM handle, unused.
+ * @param   flags  PAM flags, unused.
+ * @param   argc   The number of module arguments.
+ * @param   argv   The module arguments.
+ * @return         `PAM_SUCCESS`.
+ */
+PAM_EXTERN int pam_sm_close_session(pam_handle_t* pamh, int flags, int argc, const char** argv)
+{
+  (void) pamh;
+  (void) flags;
+  notify("close", argc, argv);
+  return PAM_SUCCESS;
+}
@@ -0,0 +1,297 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "pressure.h"
+#include "source.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+
+
+/**
+ * The resources whose pressure is watched, the names
+ * of their files in the pressure directory.
+ */
+static const char* const resources[] = {"cpu", "io"};
+
+/**
+ * The file descriptors with the triggers, -1 for
+ * resources that are not watched.
+ */
+static int triggers[sizeof(resources) / sizeof(*resources)];
+
+/**
+ * Whether any trigger was registered.
+ */
+static int watching = 0;
+
+/**
+ * The time of the last pressure, per `CLOCK_REALTIME`,
+ * 0 if there has not been any.
+ */
+static time_t last_pressure = 0;
+
+/**
+ * The time, per `CLOCK_MONOTONIC`, when the triggers
+ * shall be watched again, 0 if they are watched.
+ */
+static time_t rearm_time = 0;
+
+/**
+ * The time, per `CLOCK_MONOTONIC`, before which the
+ * triggers fire spuriously.
+ */
+static time_t settled_time = 0;
+
+
+
+/**
+ * Get how long it has been since the last resource pressure,
+ * as recorded by `pressure_source` in the environment
+ * variable AUTOHALTD_PRESSURE_LAST.
+ * 
+ * @param   now   The current time.
+ * @param   idle  Output parameter for the number of
+ *                seconds since the last pressure.
+ * @return        1 if `idle` was set, 0 if AUTOHALTD_PRESSURE
+ *                or AUTOHALTD_PRESSURE_LAST is not set.
+ */
+int get_pressure_idle_time(time_t now, unsigned long long int* idle)
+{
+  const char* dir = getenv("AUTOHALTD_PRESSURE");
+  const char* last = getenv("AUTOHALTD_PRESSURE_LAST");
+  time_t t;
+  
+  if (!dir || !*dir || !last || !*last)
+    return 0;
+  t = (time_t)atoll(last);
+  *idle = (now > t) ? (unsigned long long int)(now - t) : 0;
+  return 1;
+}
+
+
+/**
+ * Register a trigger on the pressure of a resource.
+ * 
+ * @param   dirfd  File descriptor for the pressure directory.
+ * @param   name   The name of the resource's file.
+ * @return         The file descriptor of the trigger, -2 if the
+ *                 kernel does not track the resource, -1 on error.
+ */
+static int add_trigger(int dirfd, const char* name)
+{
+  char trigger[sizeof("some  ") + 2 * 3 * sizeof(long int)];
+  int fd, saved_errno;
+  
+  sprintf(trigger, "some %li %li", (long int)AUTOHALTD_PRESSURE_STALL, (long int)AUTOHALTD_PRESSURE_WINDOW);
+  fd = openat(dirfd, name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return (errno == ENOENT) ? -2 : -1;
+  /* The trigger is removed when the file is closed. */
+  if (write(fd, trigger, strlen(trigger) + 1) < 0)
+    {
+      saved_errno = errno;
+      close(fd);
+      errno = saved_errno;
+      return (errno == EOPNOTSUPP) ? -2 : -1;
+    }
+  return fd;
+}
+
+
+/**
+ * Start watching the resource pressure, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @return         Zero on success, -1 on error.
+ */
+static int pressure_open(int epfd, unsigned index)
+{
+  const char* path = getenv("AUTOHALTD_PRESSURE");
+  const char* last = getenv("AUTOHALTD_PRESSURE_LAST");
+  struct epoll_event ev;
+  struct timespec now;
+  size_t i;
+  int dirfd, saved_errno;
+  
+  for (i = 0; i < sizeof(triggers) / sizeof(*triggers); i++)
+    triggers[i] = -1;
+  if ((path == NULL) || (*path == '\0'))
+    return 0;
+  if (last && *last)
+    last_pressure = (time_t)atoll(last);
+  
+  /* The kernel only keeps the stall time that triggers measure
+   * up to date while there are triggers, so a new trigger counts
+   * stalls from before it was registered, in its first windows. */
+  if (clock_now(CLOCK_MONOTONIC, &now))
+    return -1;
+  settled_time = now.tv_sec + 2 * (AUTOHALTD_PRESSURE_WINDOW / 1000000 + 1);
+  
+  /* A kernel without pressure stall information has nothing to watch. */
+  dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd < 0)
+    return (errno == ENOENT) ? 0 : -1;
+  watching = 1;
+  for (i = 0; i < sizeof(triggers) / sizeof(*triggers); i++)
+    {
+      triggers[i] = add_trigger(dirfd, resources[i]);
+      if (triggers[i] == -2)
+	continue; /* Let a kernel that lacks a resource watch the others. */
+      if (triggers[i] < 0)
+	goto fail;
+      /* One-shot, so that only the first pressure after re-arming wakes
+       * us. This fails with EPERM if the file is a regular file, so a
+       * stand-in for the pressure stall information must be a FIFO. */
+      ev.events = EPOLLPRI | EPOLLONESHOT;
+      ev.data.u64 = SOURCE_DATA(index, triggers[i]);
+      if (epoll_ctl(epfd, EPOLL_CTL_ADD, triggers[i], &ev))
+	goto fail;
+    }
+  close(dirfd);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(dirfd);
+  for (i = 0; i < sizeof(triggers) / sizeof(*triggers); i++)
+    if (triggers[i] >= 0)
+      {
+	close(triggers[i]); /* Also removes it from `epfd`. */
+	triggers[i] = -1;
+      }
+  watching = 0;
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Handle resource pressure, see `struct source`.
+ * 
+ * @param   epfd    The epoll(7) instance.
+ * @param   index   The index of the source.
+ * @param   fd      The file descriptor.
+ * @param   events  The epoll(7) events.
+ * @return          0 on success, -1 on error.
+ */
+static int pressure_handle(int epfd, unsigned index, int fd, uint32_t events)
+{
+  struct epoll_event ev;
+  struct timespec now;
+  size_t i;
+  
+  if (events & EPOLLERR)
+    {
+      /* The trigger is gone, and will not fire again. */
+      epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+      close(fd);
+      for (i = 0; i < sizeof(triggers) / sizeof(*triggers); i++)
+	if (triggers[i] == fd)
+	  triggers[i] = -1;
+      return 0;
+    }
+  
+  if (clock_now(CLOCK_MONOTONIC, &now))
+    return -1;
+  if (now.tv_sec < settled_time)
+    {
+      /* Spurious, look again. */
+      ev.events = EPOLLPRI | EPOLLONESHOT;
+      ev.data.u64 = SOURCE_DATA(index, fd);
+      return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+  
+  /* Pressure. The triggers are left disarmed for a while, and
+   * if any fired meanwhile, it is reported when re-armed. */
+  if (!rearm_time)
+    rearm_time = now.tv_sec + AUTOHALTD_PRESSURE_COALESCE;
+  if (!clock_now(CLOCK_REALTIME, &now))
+    last_pressure = now.tv_sec;
+  return 0;
+}
+
+
+/**
+ * Re-arm the triggers, see `struct source`.
+ * 
+ * @param   epfd   The epoll(7) instance.
+ * @param   index  The index of the source.
+ * @param   now    The time, per `CLOCK_MONOTONIC`.
+ * @return         The number of seconds until this function
+ *                 shall be called again, 0 if it need not be called.
+ */
+static time_t pressure_tick(int epfd, unsigned index, time_t now)
+{
+  struct epoll_event ev;
+  size_t i;
+  
+  if (!rearm_time)
+    return 0;
+  if (now < rearm_time)
+    return rearm_time - now;
+  
+  rearm_time = 0;
+  ev.events = EPOLLPRI | EPOLLONESHOT;
+  for (i = 0; i < sizeof(triggers) / sizeof(*triggers); i++)
+    if (triggers[i] >= 0)
+      {
+	ev.data.u64 = SOURCE_DATA(index, triggers[i]);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, triggers[i], &ev);
+      }
+  return 0;
+}
+
+
+/**
+ * Store the time of the last pressure in the
+ * environment, see `struct source`.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+static int pressure_save(void)
+{
+  char envval[3 * sizeof(long long int) + 2];
+  if (!watching || !last_pressure)
+    return 0;
+  sprintf(envval, "%lli", (long long int)last_pressure);
+  return setenv("AUTOHALTD_PRESSURE_LAST", envval, 1);
+}
+
+
+/**
+ * Activity source that records the time of the last
+ * significant CPU or I/O pressure, by registering
+ * triggers on the pressure stall information files in
+ * the directory specified by the environment variable
+ * AUTOHALTD_PRESSURE.
+ */
+const struct source pressure_source = {
+  .open   = pressure_open,
+  .handle = pressure_handle,
+  .tick   = pressure_tick,
+  .save   = pressure_save,
+};
@@ -0,0 +1,76 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * When built with static tracepoints (./configure --with-sdt),
+ * the following probes, of the provider "autohaltd", can be
+ * traced with bpftrace(8), perf(1), or SystemTap, in the
+ * autohaltd-check image under $(LIBEXECDIR)/autohaltd, e.g.
+ * 
+ *   bpftrace -e 'usdt:/usr/libexec/autohaltd/autohaltd-check:autohaltd:deadline
+ *                { printf("%d %llu\n", arg0, arg1); }'
+ * 
+ * Each probe is a single nop until a tracer is attached.
+ * 
+ *   check_start                The halt check has started.
+ *   scan_start                 utmp is about to be read.
+ *   utmp_record(type, pid, class)
+ *                              A record in utmp has been read,
+ *                              and was classified by replay_record.
+ *   scan_end(records, logins)  utmp has been read. `logins` is the
+ *                              number of logins that have not ended.
+ *   login_verdict(pid, line, verdict)
+ *                              A login has been probed: -1 if it is
+ *                              not a login, 0 if it is inactive, 1
+ *                              if it is active. `line` is not always
+ *                              NUL-terminated.
+ *   stage(id, result, nanoseconds)
+ *                              A stage of the check has run. See the
+ *                              CHECK_STAGE_* constants in check.h.
+ *   check_end(result, seconds, reason)
+ *                              The halt check has been made. `seconds`
+ *                              is the time until the next check, if
+ *                              `result` is 0. See the REASON_* constants
+ *                              in check.h.
+ *   deadline(seconds, tier)    autohaltd-check has decided to sleep
+ *                              for `seconds`.
+ *   sleep_armed(seconds, left) autohaltd-sleep is about to sleep for
+ *                              `seconds`, of `left` in total.
+ *   sleep_woken                An activity source requested a check.
+ *   sighup                     autohaltd-sleep received SIGHUP and is
+ *                              about to re-exec itself.
+ *   suspend(state)             The machine is about to be suspended.
+ *   halt                       shutdown(8) is about to be executed.
+ */
+#ifdef USE_SDT
+
+# include <sys/sdt.h>
+
+# define PROBE(NAME)              DTRACE_PROBE(autohaltd, NAME)
+# define PROBE1(NAME, A)          DTRACE_PROBE1(autohaltd, NAME, A)
+# define PROBE2(NAME, A, B)       DTRACE_PROBE2(autohaltd, NAME, A, B)
+# define PROBE3(NAME, A, B, C)    DTRACE_PROBE3(autohaltd, NAME, A, B, C)
+
+#else
+
+# define PROBE(NAME)              ((void)0)
+# define PROBE1(NAME, A)          ((void)0)
+# define PROBE2(NAME, A, B)       ((void)0)
+# define PROBE3(NAME, A, B, C)    ((void)0)
+
+#endif
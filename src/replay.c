@@ -0,0 +1,291 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "replay.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <utmpx.h>
+#include <utmp.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_AVX2_FILTER
+# include <immintrin.h>
+#endif
+
+
+
+/**
+ * Get the time of a record.
+ */
+#ifdef _HAVE_UT_TV
+# define SET_TIMESPEC(ts, u)					\
+  ((ts)->tv_sec = (time_t)((u)->ut_tv.tv_sec),			\
+   (ts)->tv_nsec = (long)((u)->ut_tv.tv_usec) * 1000L)
+#else
+# define SET_TIMESPEC(ts, u)					\
+  ((ts)->tv_sec = (time_t)((u)->ut_time),			\
+   (ts)->tv_nsec = 0)
+#endif
+
+
+
+/**
+ * Start a replay.
+ * 
+ * @param  state  The state of the replay.
+ * @param  start  The time to use as the last logout until
+ *                a logout or boot has been replayed.
+ */
+void replay_init(struct replay* state, const struct timespec* start)
+{
+  memset(state, 0, sizeof(*state));
+  state->last = *start;
+}
+
+
+/**
+ * Release the resources of a replay.
+ * 
+ * @param  state  The state of the replay.
+ */
+void replay_destroy(struct replay* state)
+{
+  free(state->logins);
+  state->logins = NULL;
+  state->nlogins = state->size = 0;
+}
+
+
+/**
+ * Replay a record.
+ * 
+ * Logins are kept in the order they started. A login
+ * ends when a DEAD_PROCESS, LOGIN_PROCESS, or INIT_PROCESS
+ * record with the same process ID is replayed.
+ * 
+ * @param   state  The state of the replay.
+ * @param   u      The record. Its strings need not be NUL-terminated.
+ * @return         `REPLAY_LOGIN`, `REPLAY_LOGOUT`, `REPLAY_BOOT`, or
+ *                 `REPLAY_OTHER`, depending on the type of the record,
+ *                 -1 on error.
+ */
+int replay_record(struct replay* state, const struct utmpx* u)
+{
+  struct timespec newtime;
+  size_t i;
+  void* new;
+  
+  switch (u->ut_type)
+    {
+      /* Strings are not necessarily terminated! */
+      
+    /* Not LOGIN_PROCESS, the login process changes LOGIN_PROCESS
+     * to USER_PROCESS. LOGIN_PROCESS indicates getty, or a login
+     * that has been be completed. */
+    case USER_PROCESS:
+#ifdef DEBUG
+      fprintf(stderr, "Login: pid=%ji, user=%s, line=%s, host=%s\n",
+	      (intmax_t)(u->ut_pid), u->ut_line, u->ut_user, u->ut_host);
+      {
+	struct timespec ts;
+	SET_TIMESPEC(&ts, u);
+	DEBUF_PRINT_TIME("Login time", ts);
+      }
+#endif
+      if (state->nlogins == state->size)
+	{
+	  state->size = state->size ? (state->size << 1) : 16;
+	  new = realloc(state->logins, state->size * sizeof(*state->logins));
+	  if (new == NULL)
+	    return -1;
+	  state->logins = new;
+	}
+      state->logins[state->nlogins++] = *u;
+      return REPLAY_LOGIN;
+      
+    case DEAD_PROCESS:
+    case LOGIN_PROCESS: /* See above. */
+    case INIT_PROCESS: /* Spawned by init, potentially a getty. */
+      for (i = 0; i < state->nlogins; i++)
+	if (state->logins[i].ut_pid == u->ut_pid)
+	  break;
+#ifdef DEBUG
+      fprintf(stderr, "Logout: pid=%ji, type=%s\n", (intmax_t)(u->ut_pid),
+	      u->ut_type == DEAD_PROCESS ? "dead" : u->ut_type == LOGIN_PROCESS ? "login" : "init");
+#endif
+      if (i < state->nlogins)
+	memmove(state->logins + i, state->logins + i + 1,
+		(--state->nlogins - i) * sizeof(*state->logins));
+      SET_TIMESPEC(&state->last, u);
+      memset(&state->delta, 0, sizeof(state->delta));
+      DEBUF_PRINT_TIME("Logout time", state->last);
+      return REPLAY_LOGOUT;
+      
+    case BOOT_TIME:
+      state->have_oldtime = 0;
+      memset(&state->delta, 0, sizeof(state->delta));
+      SET_TIMESPEC(&state->last, u);
+      DEBUF_PRINT_TIME("Boot time", state->last);
+      return REPLAY_BOOT;
+      
+    case OLD_TIME:
+      state->have_oldtime = 1;
+      SET_TIMESPEC(&state->oldtime, u);
+      DEBUF_PRINT_TIME("Old time", state->oldtime);
+      return REPLAY_OTHER;
+      
+    case NEW_TIME:
+      if (state->have_oldtime == 0)
+	return REPLAY_OTHER;
+      state->have_oldtime = 0;
+      SET_TIMESPEC(&newtime, u);
+      DEBUF_PRINT_TIME("New time", newtime);
+      newtime.tv_sec -= state->oldtime.tv_sec;
+      newtime.tv_nsec -= state->oldtime.tv_nsec;
+      ADJUST_NSEC(&newtime);
+      DEBUF_PRINT_TIME("New time - old time", newtime);
+      state->delta.tv_sec += newtime.tv_sec;
+      state->delta.tv_nsec += newtime.tv_nsec;
+      ADJUST_NSEC(&state->delta);
+      DEBUF_PRINT_TIME("Delta time", state->delta);
+      return REPLAY_OTHER;
+      
+    default:
+      return REPLAY_OTHER;
+    }
+}
+
+
+/**
+ * Get the time elapsed since the last logout or boot,
+ * adjusted for changes of the system clock.
+ * 
+ * @param  state     The state of the replay.
+ * @param  now       The current time.
+ * @param  duration  Output parameter for the elapsed time.
+ */
+void replay_idle_time(const struct replay* state, const struct timespec* now, struct timespec* duration)
+{
+  /* The logout was recorded by the clock before it was changed,
+   * so move it as far as the clock has been moved since. */
+  duration->tv_sec = state->last.tv_sec + state->delta.tv_sec;
+  duration->tv_nsec = state->last.tv_nsec + state->delta.tv_nsec;
+  ADJUST_NSEC(duration);
+  DEBUF_PRINT_TIME("Last logout, delta-adjusted", *duration);
+  
+  duration->tv_sec = now->tv_sec - duration->tv_sec;
+  duration->tv_nsec = now->tv_nsec - duration->tv_nsec;
+  ADJUST_NSEC(duration);
+}
+
+
+/**
+ * Find the records of interest in an array of records.
+ * 
+ * @param   records  The records.
+ * @param   n        The number of elements in `records`.
+ * @param   types    The types of interest, as bits `1 << ut_type`.
+ * @param   out      Output parameter for the indices of the records of interest.
+ * @return           The number of elements stored in `out`.
+ */
+static size_t filter_scalar(const struct utmpx* records, size_t n, unsigned int types, unsigned int* out)
+{
+  size_t i, k = 0;
+  unsigned int type;
+  
+  for (i = 0; i < n; i++)
+    {
+      /* Branch-free, the types are not predictable. */
+      type = (unsigned short)(records[i].ut_type);
+      out[k] = (unsigned int)i;
+      k += (size_t)((type < 32) & (types >> (type & 31)) & 1U);
+    }
+  return k;
+}
+
+
+#ifdef HAVE_AVX2_FILTER
+/**
+ * Find the records of interest in an array of records, eight at
+ * a time, by gathering the types from the record stride.
+ * 
+ * @param   records  The records.
+ * @param   n        The number of elements in `records`.
+ * @param   types    The types of interest, as bits `1 << ut_type`.
+ * @param   out      Output parameter for the indices of the records of interest.
+ * @return           The number of elements stored in `out`.
+ */
+__attribute__((target("avx2")))
+static size_t filter_avx2(const struct utmpx* records, size_t n, unsigned int types, unsigned int* out)
+{
+#define S  ((int)sizeof(struct utmpx))
+  const __m256i stride = _mm256_setr_epi32(0 * S, 1 * S, 2 * S, 3 * S, 4 * S, 5 * S, 6 * S, 7 * S);
+  const __m256i low = _mm256_set1_epi32(0xFFFF);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i set = _mm256_set1_epi32((int)types);
+  const char* base = (const char*)records + offsetof(struct utmpx, ut_type);
+  __m256i v;
+  size_t i, k = 0;
+  unsigned int mask;
+  
+  for (i = 0; i + 8 <= n; i += 8, base += 8 * S)
+    {
+      /* The type is a short, at the start of a little-endian int.
+       * Shifting by 32 or more yields 0, so invalid types are not
+       * of interest. */
+      v = _mm256_i32gather_epi32((const int*)(const void*)base, stride, 1);
+      v = _mm256_and_si256(_mm256_srlv_epi32(set, _mm256_and_si256(v, low)), one);
+      mask = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, one)));
+      for (; mask; mask &= mask - 1)
+	out[k++] = (unsigned int)i + (unsigned int)__builtin_ctz(mask);
+    }
+  
+  n = filter_scalar(records + i, n - i, types, out + k);
+  while (n--)
+    out[k++] += (unsigned int)i;
+  return k;
+#undef S
+}
+#endif
+
+
+/**
+ * Find the records of interest in an array of records, so that
+ * only they need to be replayed. Only the type of each record
+ * is read, with AVX2 if the processor supports it.
+ * 
+ * @param   records  The records.
+ * @param   n        The number of elements in `records`, at most `UINT_MAX`.
+ * @param   types    The types of interest, as bits `1 << ut_type`,
+ *                   for example `REPLAY_TYPES`.
+ * @param   out      Output parameter for the indices, in `records`, of
+ *                   the records of interest, in ascending order. Must
+ *                   have room for `n` elements.
+ * @return           The number of elements stored in `out`.
+ */
+size_t replay_filter(const struct utmpx* records, size_t n, unsigned int types, unsigned int* out)
+{
+#ifdef HAVE_AVX2_FILTER
+  if (__builtin_cpu_supports("avx2"))
+    return filter_avx2(records, n, types, out);
+#endif
+  return filter_scalar(records, n, types, out);
+}
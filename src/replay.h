@@ -0,0 +1,160 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+struct utmpx;
+
+
+
+/**
+ * The record started a login.
+ */
+#define REPLAY_LOGIN  0
+
+/**
+ * The record ended a login, or a getty was
+ * spawned, which is treated as a logout.
+ */
+#define REPLAY_LOGOUT  1
+
+/**
+ * The record marks a boot.
+ */
+#define REPLAY_BOOT  2
+
+/**
+ * The record adjusts for a change of the system clock,
+ * or is of no interest.
+ */
+#define REPLAY_OTHER  3
+
+/**
+ * The record types, as bits `1 << ut_type`, that
+ * `replay_record` does not ignore. Requires <utmpx.h>.
+ */
+#define REPLAY_TYPES  ((1U << USER_PROCESS) | (1U << DEAD_PROCESS) | (1U << LOGIN_PROCESS) |  \
+		       (1U << INIT_PROCESS) | (1U << BOOT_TIME) | (1U << OLD_TIME) | (1U << NEW_TIME))
+
+
+
+/**
+ * The state of a replay of utmp or wtmp records.
+ */
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+struct replay
+{
+  /**
+   * The logins that have not ended.
+   */
+  struct utmpx* logins;
+  
+  /**
+   * The number of elements in `logins`.
+   */
+  size_t nlogins;
+  
+  /**
+   * The allocation size of `logins`.
+   */
+  size_t size;
+  
+  /**
+   * The time of the last logout or boot.
+   */
+  struct timespec last;
+  
+  /**
+   * The amount the clock has been changed by since `last`.
+   */
+  struct timespec delta;
+  
+  /**
+   * The time before the pending change of the clock.
+   */
+  struct timespec oldtime;
+  
+  /**
+   * Whether `oldtime` is set.
+   */
+  int have_oldtime;
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
+/**
+ * Start a replay.
+ * 
+ * @param  state  The state of the replay.
+ * @param  start  The time to use as the last logout until
+ *                a logout or boot has been replayed.
+ */
+void replay_init(struct replay* state, const struct timespec* start);
+
+/**
+ * Release the resources of a replay.
+ * 
+ * @param  state  The state of the replay.
+ */
+void replay_destroy(struct replay* state);
+
+/**
+ * Replay a record.
+ * 
+ * Logins are kept in the order they started. A login
+ * ends when a DEAD_PROCESS, LOGIN_PROCESS, or INIT_PROCESS
+ * record with the same process ID is replayed.
+ * 
+ * @param   state  The state of the replay.
+ * @param   u      The record. Its strings need not be NUL-terminated.
+ * @return         `REPLAY_LOGIN`, `REPLAY_LOGOUT`, `REPLAY_BOOT`, or
+ *                 `REPLAY_OTHER`, depending on the type of the record,
+ *                 -1 on error.
+ */
+int replay_record(struct replay* state, const struct utmpx* u);
+
+/**
+ * Get the time elapsed since the last logout or boot,
+ * adjusted for changes of the system clock.
+ * 
+ * @param  state     The state of the replay.
+ * @param  now       The current time.
+ * @param  duration  Output parameter for the elapsed time.
+ */
+void replay_idle_time(const struct replay* state, const struct timespec* now, struct timespec* duration);
+
+/**
+ * Find the records of interest in an array of records, so that
+ * only they need to be replayed. Only the type of each record
+ * is read, with AVX2 if the processor supports it.
+ * 
+ * @param   records  The records.
+ * @param   n        The number of elements in `records`, at most `UINT_MAX`.
+ * @param   types    The types of interest, as bits `1 << ut_type`,
+ *                   for example `REPLAY_TYPES`.
+ * @param   out      Output parameter for the indices, in `records`, of
+ *                   the records of interest, in ascending order. Must
+ *                   have room for `n` elements.
+ * @return           The number of elements stored in `out`.
+ */
+size_t replay_filter(const struct utmpx* records, size_t n, unsigned int types, unsigned int* out);
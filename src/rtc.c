@@ -0,0 +1,194 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "rtc.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <alloca.h>
+
+
+
+/**
+ * Parse a time of day on the format "HH:MM".
+ * 
+ * @param   str  The string to parse.
+ * @return       The number of minutes after midnight, -1 if invalid.
+ */
+int parse_wake_time(const char* str)
+{
+  int h, m;
+  
+  if (!isdigit(str[0]) || !isdigit(str[1]) || (str[2] != ':') ||
+      !isdigit(str[3]) || !isdigit(str[4]) || str[5])
+    return -1;
+  h = (str[0] - '0') * 10 + (str[1] - '0');
+  m = (str[3] - '0') * 10 + (str[4] - '0');
+  if ((h > 23) || (m > 59))
+    return -1;
+  return h * 60 + m;
+}
+
+
+/**
+ * Parse a list of weekdays, such as "1-5" or "1,3,5-7",
+ * where 1 is Monday and 7 is Sunday.
+ * 
+ * @param   str  The string to parse.
+ * @return       A bitmask where bit 0 is Sunday and bit 6 is
+ *               Saturday, as numbered by `struct tm`'s `tm_wday`,
+ *               -1 if invalid.
+ */
+int parse_wake_days(const char* str)
+{
+  int mask = 0, first, last;
+  
+  for (;;)
+    {
+      if ((*str < '1') || ('7' < *str))
+	return -1;
+      first = last = *str++ - '0';
+      if (*str == '-')
+	{
+	  str++;
+	  if ((*str < '1') || ('7' < *str))
+	    return -1;
+	  last = *str++ - '0';
+	  if (last < first)
+	    return -1;
+	}
+      for (; first <= last; first++)
+	mask |= 1 << (first % 7);
+      if (*str == '\0')
+	return mask;
+      if (*str++ != ',')
+	return -1;
+    }
+}
+
+
+/**
+ * Write a string to a sysfs attribute.
+ * 
+ * @param   path   The pathname of the attribute.
+ * @param   value  The string to write.
+ * @return         Zero on success, -1 on error.
+ */
+static int write_attribute(const char* path, const char* value)
+{
+  size_t len = strlen(value);
+  ssize_t r;
+  int fd, saved_errno;
+  
+  fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  r = write(fd, value, len);
+  saved_errno = errno;
+  if (close(fd) && (r >= 0))
+    return -1;
+  errno = saved_errno;
+  return ((size_t)r == len) ? 0 : -1;
+}
+
+
+/**
+ * Program the real-time clock to wake the machine at the
+ * next time, specified by the environment variables
+ * AUTOHALTD_WAKE and AUTOHALTD_WAKE_DAYS, or at `deadline`,
+ * whichever is earlier. The real-time clock is specified by
+ * the environment variable AUTOHALTD_RTC, and defaults to
+ * `AUTOHALTD_RTC_DIRECTORY`.
+ * 
+ * Nothing is done if AUTOHALTD_WAKE is not set and
+ * `deadline` is 0.
+ * 
+ * @param   deadline  The latest time the machine shall be woken,
+ *                    0 if the machine shall only be woken at the
+ *                    time specified by AUTOHALTD_WAKE.
+ * @return            Zero on success, -1 on error.
+ */
+int set_wake_alarm(time_t deadline)
+{
+  const char* wake = getenv("AUTOHALTD_WAKE");
+  const char* days = getenv("AUTOHALTD_WAKE_DAYS");
+  const char* rtc = getenv("AUTOHALTD_RTC");
+  char* path;
+  char value[3 * sizeof(long long int) + 2];
+  int minutes, mask = 0x7F, i;
+  time_t now, alarm_time = deadline;
+  struct tm tm;
+  
+  if (wake == NULL)
+    goto have_time;
+  minutes = parse_wake_time(wake);
+  if (days)
+    mask = parse_wake_days(days);
+  if ((minutes < 0) || (mask < 0))
+    return errno = EINVAL, -1;
+  
+  /* Find the first time after shutdown has had time to complete. */
+  now = time(NULL) + AUTOHALTD_WAKE_MARGIN;
+  if (localtime_r(&now, &tm) == NULL)
+    return -1;
+  tm.tm_hour = minutes / 60;
+  tm.tm_min = minutes % 60;
+  tm.tm_sec = 0;
+  for (i = 0; i <= 7; i++, tm.tm_mday++)
+    {
+      tm.tm_isdst = -1;
+      alarm_time = mktime(&tm);
+      if (alarm_time == (time_t)-1)
+	return -1;
+      if ((alarm_time > now) && (mask & (1 << tm.tm_wday)))
+	break;
+      /* mktime has normalised `tm`, restore the time of day,
+       * in case daylight saving time shifted it. */
+      tm.tm_hour = minutes / 60;
+      tm.tm_min = minutes % 60;
+    }
+  if (i > 7)
+    return errno = EINVAL, -1;
+  if (deadline && (deadline < alarm_time))
+    alarm_time = deadline;
+  
+ have_time:
+  if (alarm_time == 0)
+    return 0;
+  if (rtc == NULL)
+    rtc = AUTOHALTD_RTC_DIRECTORY;
+#ifdef DEBUG
+  fprintf(stderr, "Wake alarm: %lli\n", (long long int)alarm_time);
+#endif
+  
+  path = alloca(strlen(rtc) + sizeof("/wakealarm"));
+  stpcpy(stpcpy(path, rtc), "/wakealarm");
+  
+  /* An alarm that is already set must be cleared first. */
+  if (write_attribute(path, "0\n"))
+    return -1;
+  sprintf(value, "%lli\n", (long long int)alarm_time);
+  return write_attribute(path, value);
+}
+
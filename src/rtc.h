@@ -0,0 +1,63 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+
+
+
+/**
+ * Parse a time of day on the format "HH:MM".
+ * 
+ * @param   str  The string to parse.
+ * @return       The number of minutes after midnight, -1 if invalid.
+ */
+#ifdef __GNUC__
+__attribute__((__pure__))
+#endif
+int parse_wake_time(const char* str);
+
+/**
+ * Parse a list of weekdays, such as "1-5" or "1,3,5-7",
+ * where 1 is Monday and 7 is Sunday.
+ * 
+ * @param   str  The string to parse.
+ * @return       A bitmask where bit 0 is Sunday and bit 6 is
+ *               Saturday, as numbered by `struct tm`'s `tm_wday`,
+ *               -1 if invalid.
+ */
+#ifdef __GNUC__
+__attribute__((__pure__))
+#endif
+int parse_wake_days(const char* str);
+
+/**
+ * Program the real-time clock to wake the machine at the
+ * next time, specified by the environment variables
+ * AUTOHALTD_WAKE and AUTOHALTD_WAKE_DAYS, or at `deadline`,
+ * whichever is earlier. The real-time clock is specified by
+ * the environment variable AUTOHALTD_RTC, and defaults to
+ * `AUTOHALTD_RTC_DIRECTORY`.
+ * 
+ * Nothing is done if AUTOHALTD_WAKE is not set and
+ * `deadline` is 0.
+ * 
+ * @param   deadline  The latest time the machine shall be woken,
+ *                    0 if the machine shall only be woken at the
+ *                    time specified by AUTOHALTD_WAKE.
+ * @return            Zero on success, -1 on error.
+ */
+int set_wake_alarm(time_t deadline);
+
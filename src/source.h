@@ -0,0 +1,90 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+#include <stdint.h>
+
+
+
+/**
+ * Pack the index of a source and a file descriptor
+ * into the data of an epoll(7) event.
+ */
+#define SOURCE_DATA(index, fd)  (((uint64_t)(index) << 32) | (uint64_t)(uint32_t)(fd))
+
+/**
+ * Get the index of the source from the data of an epoll(7) event.
+ */
+#define SOURCE_INDEX(data)  ((unsigned)((data) >> 32))
+
+/**
+ * Get the file descriptor from the data of an epoll(7) event.
+ */
+#define SOURCE_FD(data)  ((int)(uint32_t)(data))
+
+
+
+/**
+ * Something the sleep image waits on, alongside its
+ * timer, that tells whether the machine is in use.
+ * Sources keep their state in the environment, so
+ * that it survives the exec chain.
+ */
+struct source
+{
+  /**
+   * Start watching, if configured.
+   * 
+   * @param   epfd   The epoll(7) instance to add file descriptors
+   *                 to, with `SOURCE_DATA(index, fd)` as the data.
+   * @param   index  The index of the source.
+   * @return         Zero on success, -1 on error.
+   */
+  int (*open)(int epfd, unsigned index);
+  
+  /**
+   * Handle an event on one of the source's file descriptors.
+   * 
+   * @param   epfd    The epoll(7) instance.
+   * @param   index   The index of the source.
+   * @param   fd      The file descriptor.
+   * @param   events  The epoll(7) events.
+   * @return          1 if the machine shall be checked now,
+   *                  0 otherwise, -1 on error.
+   */
+  int (*handle)(int epfd, unsigned index, int fd, uint32_t events);
+  
+  /**
+   * Do timed work, may be `NULL`.
+   * 
+   * @param   epfd   The epoll(7) instance.
+   * @param   index  The index of the source.
+   * @param   now    The time, per `CLOCK_MONOTONIC`.
+   * @return         The number of seconds until this
+   *                 function shall be called again,
+   *                 0 if it need not be called.
+   */
+  time_t (*tick)(int epfd, unsigned index, time_t now);
+  
+  /**
+   * Store the state in the environment, before
+   * exec:ing, may be `NULL`.
+   * 
+   * @return  Zero on success, -1 on error.
+   */
+  int (*save)(void);
+};
+
@@ -0,0 +1,303 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "trace.h"
+#include "check.h"
+#include "clock.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef USE_GETTEXT
+# include <libintl.h>
+# define _(MSG)  (gettext(MSG))
+#else
+# define _(MSG)  (MSG)
+#endif
+
+
+
+/**
+ * Identifies a flight recorder file, and its format.
+ */
+#define TRACE_MAGIC  "AHTRACE1"
+
+
+
+/**
+ * A decision, as stored in the flight recorder file.
+ */
+struct trace_record
+{
+  /**
+   * The record's ordinal, starting at 1. Written
+   * last, so that partially written records can
+   * be recognised. 0 if not written.
+   */
+  uint64_t seq;
+  
+  /**
+   * `CLOCK_REALTIME` when the decision was made, in seconds.
+   */
+  int64_t time;
+  
+  /**
+   * `CLOCK_BOOTTIME` when the decision was made, in seconds.
+   */
+  int64_t uptime;
+  
+  /**
+   * The number of seconds since the last logout.
+   */
+  uint64_t idle;
+  
+  /**
+   * The number of seconds until the next check,
+   * 0 if the machine was halted.
+   */
+  uint64_t next;
+  
+  /**
+   * The number of active logins, -1 if unknown.
+   */
+  int32_t logins;
+  
+  /**
+   * Why the decision was made, one of the `REASON_*` constants.
+   */
+  int32_t reason;
+};
+
+
+/**
+ * The layout of the flight recorder file.
+ */
+struct trace_file
+{
+  /**
+   * `TRACE_MAGIC`, not NUL-terminated.
+   */
+  char magic[8];
+  
+  /**
+   * The number of records the file can hold.
+   */
+  uint64_t capacity;
+  
+  /**
+   * The number of records that have ever been
+   * appended. The next record is written at
+   * index `written % capacity`.
+   */
+  uint64_t written;
+  
+  /**
+   * The records, in a ring buffer.
+   */
+  struct trace_record records[];
+};
+
+
+/**
+ * Map the flight recorder file.
+ * 
+ * @param   writable  Whether the file shall be created, if
+ *                    missing, and be mapped for writing.
+ * @param   size      Output parameter for the size of the mapping.
+ * @return            The mapped file, `NULL` on error.
+ */
+static struct trace_file* trace_map(int writable, size_t* size)
+{
+  struct trace_file* header;
+  struct stat attr;
+  int fd, saved_errno;
+  
+  *size = sizeof(struct trace_file) + AUTOHALTD_TRACE_RECORDS * sizeof(struct trace_record);
+  
+  fd = writable ? open(AUTOHALTD_TRACE_PATHNAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644)
+		: open(AUTOHALTD_TRACE_PATHNAME, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &attr))
+    goto fail;
+  if (writable && (attr.st_size == 0))
+    {
+      /* New file. It is zero-filled, so it only lacks the header. */
+      if (ftruncate(fd, (off_t)*size))
+	goto fail;
+    }
+  else if ((size_t)(attr.st_size) < sizeof(struct trace_file))
+    {
+      errno = EBADMSG;
+      goto fail;
+    }
+  else
+    *size = (size_t)(attr.st_size);
+  
+  header = mmap(NULL, *size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, (off_t)0);
+  if (header == MAP_FAILED)
+    goto fail;
+  close(fd);
+  
+  if (writable && (attr.st_size == 0))
+    {
+      header->capacity = AUTOHALTD_TRACE_RECORDS;
+      memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    }
+  if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) || (header->capacity == 0) ||
+      (header->capacity > (*size - sizeof(*header)) / sizeof(struct trace_record)))
+    {
+      munmap(header, *size);
+      errno = EBADMSG;
+      return NULL;
+    }
+  return header;
+  
+ fail:
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return NULL;
+}
+
+
+/**
+ * Append a decision to the flight recorder.
+ * 
+ * @param   report  Details about the decision.
+ * @param   next    The number of seconds until the next check,
+ *                  0 if the machine is about to halt.
+ * @return          Zero on success, -1 on error. `errno` is left
+ *                  unchanged either way, so that the error of a
+ *                  failed decision can be reported after it has
+ *                  been recorded.
+ */
+int trace_append(const struct check_report* report, unsigned long long int next)
+{
+  struct trace_file* header;
+  struct trace_record* record;
+  struct timespec uptime;
+  uint64_t seq;
+  size_t size;
+  int saved_errno = errno;
+  
+  header = trace_map(1, &size);
+  if (header == NULL)
+    {
+      errno = saved_errno;
+      return -1;
+    }
+  
+  if (clock_now(CLOCK_BOOTTIME, &uptime))
+    uptime.tv_sec = 0;
+  
+  /* autohalt and autohaltd-check may append concurrently. */
+  seq = __atomic_add_fetch(&header->written, 1, __ATOMIC_RELAXED);
+  record = header->records + (seq - 1) % header->capacity;
+  __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->time   = (int64_t)(report->time.tv_sec);
+  record->uptime = (int64_t)(uptime.tv_sec);
+  record->idle   = (uint64_t)(report->idle);
+  record->next   = (uint64_t)next;
+  record->logins = (int32_t)(report->logins);
+  record->reason = (int32_t)(report->reason);
+  __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+  
+  munmap(header, size);
+  errno = saved_errno;
+  return 0;
+}
+
+
+/**
+ * Print the decisions stored in the flight recorder,
+ * oldest first.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+int print_trace(void)
+{
+  static const char* const reasons[] = {
+    [REASON_HALT]          = "halt",
+    [REASON_RECENT_LOGOUT] = "recent-logout",
+    [REASON_LOGGED_IN]     = "logged-in",
+    [REASON_ERROR]         = "error",
+    [REASON_SUSPEND]       = "suspend",
+    [REASON_HIBERNATE]     = "hibernate",
+    [REASON_CONNECTED]     = "connected",
+    [REASON_BUSY]          = "busy",
+    [REASON_INHIBITED]     = "inhibited",
+    [REASON_TIER_TAKEN]    = "already-suspended",
+  };
+  struct trace_file* header;
+  struct trace_record record;
+  const struct trace_record* slot;
+  uint64_t seq, end, s1, s2;
+  char timestr[sizeof("YYYY-MM-DD hh:mm:ss") + 16];
+  struct tm* tm;
+  time_t t;
+  size_t size;
+  int saved_errno;
+  
+  header = trace_map(0, &size);
+  if (header == NULL)
+    return -1;
+  
+  end = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+  for (seq = (end > header->capacity ? end - header->capacity : 0) + 1; seq <= end; seq++)
+    {
+      /* The writer clears seq before it rewrites the record, and sets
+       * it last, so the copy is whole only if seq was the same before
+       * and after it. Otherwise the record is being overwritten. */
+      slot = header->records + (seq - 1) % header->capacity;
+      s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+      if (s1 != seq)
+	continue;
+      memcpy(&record, slot, sizeof(record));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      s2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+      if (s2 != seq)
+	continue;
+      t = (time_t)(record.time);
+      tm = localtime(&t);
+      if ((tm == NULL) || !strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", tm))
+	sprintf(timestr, "%lli", (long long int)(record.time));
+      if (printf(_("%s  uptime=%llis  logins=%i  idle=%llus  next=%llus  %s\n"),
+		 timestr, (long long int)(record.uptime), (int)(record.logins),
+		 (unsigned long long int)(record.idle), (unsigned long long int)(record.next),
+		 ((0 <= record.reason) && ((size_t)(record.reason) < sizeof(reasons) / sizeof(*reasons)))
+		 ? reasons[record.reason] : "?") < 0)
+	goto fail;
+    }
+  
+  munmap(header, size);
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  munmap(header, size);
+  errno = saved_errno;
+  return -1;
+}
+
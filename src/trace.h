@@ -0,0 +1,46 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Details about a decision made by `is_time_for_halt`.
+ */
+struct check_report;
+
+
+
+/**
+ * Append a decision to the flight recorder.
+ * 
+ * @param   report  Details about the decision.
+ * @param   next    The number of seconds until the next check,
+ *                  0 if the machine is about to halt.
+ * @return          Zero on success, -1 on error. `errno` is left
+ *                  unchanged either way, so that the error of a
+ *                  failed decision can be reported after it has
+ *                  been recorded.
+ */
+int trace_append(const struct check_report* report, unsigned long long int next);
+
+/**
+ * Print the decisions stored in the flight recorder,
+ * oldest first.
+ * 
+ * @return  Zero on success, -1 on error.
+ */
+int print_trace(void);
+
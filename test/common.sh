@@ -0,0 +1,177 @@
+# Copyright (C) 2015  Mattias Andrée <maandree@member.fsf.org>
+# 
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+# Functions for the scenarios that `make check` runs, sourced
+# by test/run, for the scenario, and by test/hook, when the
+# fake clock is advanced. The scenario scratch directory, $T,
+# holds:
+# 
+#   clock     The fake clock, as "REALTIME BOOTTIME".
+#   utmp      The fake utmp file.
+#   wtmp      The fake wtmp file.
+#   schedule  Events, as "UPTIME COMMAND", in order.
+#   last      The uptime at which the hook last ran.
+#   pid.NAME  The process ID of the login NAME.
+#   out       The output of the daemon.
+# 
+# All times in a scenario are given as the uptime, in seconds,
+# so that they are unaffected by steps of the wall-clock. The
+# fake clock jumps to the end of each sleep, so events run when
+# the daemon wakes up after them, but utmp records are written
+# with the time the events were scheduled at.
+
+
+# The time of boot in the scenarios.
+BOOT_REALTIME=1000000000
+BOOT_BOOTTIME=0
+
+
+# Schedule a command to run when the uptime has passed a time.
+# 
+# @param  $1   The uptime, in seconds since boot.
+# @param  ...  The command.
+at ()
+{
+    t=$1
+    shift 1
+    echo "$t $*" >> "$T/schedule"
+}
+
+# Print the wall-clock time at a time scheduled with `at`,
+# that is, the current wall-clock time minus how long ago
+# that uptime was.
+# 
+# @param  $1  The uptime, in seconds since boot.
+realtime_at ()
+{
+    read real boot < "$T/clock"
+    echo $(( real - (boot - BOOT_BOOTTIME - $1) ))
+}
+
+# Write a record to the fake utmp file.
+# 
+# @param  $1  The record type, see test/mkutmp.c.
+# @param  $2  The process ID.
+# @param  $3  The terminal.
+# @param  $4  The ID, and the user for logins.
+# @param  $5  The host, for remote logins, optional.
+write_utmp ()
+{
+    "$BIN/mkutmp" "$T/utmp" "$1" "$2" "$3" "$4" $(realtime_at $at) $5
+}
+
+# Log in a user on /dev/null, whose login process has
+# /dev/null as its standard input, output, and error,
+# which makes the login active.
+# 
+# @param  $1  The name of the user, at most 4 characters.
+login ()
+{
+    sleep 1000000 < /dev/null > /dev/null 2> /dev/null &
+    echo $! > "$T/pid.$1"
+    write_utmp login $! null "$1"
+}
+
+# Log in a user remotely, as with `login`, but from a host.
+# Log out with `logout`.
+# 
+# @param  $1  The name of the user, at most 4 characters.
+# @param  $2  The host the user logged in from.
+remote_login ()
+{
+    sleep 1000000 < /dev/null > /dev/null 2> /dev/null &
+    echo $! > "$T/pid.$1"
+    write_utmp login $! null "$1" "$2"
+}
+
+# Record a login in the fake wtmp file only, as a login
+# that has been forgotten by utmp, but is kept in wtmp.
+# 
+# @param  $1  The name of the user, at most 4 characters.
+remember_login ()
+{
+    "$BIN/mkutmp" -a "$T/wtmp" login 0 null "$1" $(realtime_at $at)
+}
+
+# Log out a user logged in with `login`.
+# 
+# @param  $1  The name of the user.
+logout ()
+{
+    pid=$(cat "$T/pid.$1")
+    kill $pid
+    rm -- "$T/pid.$1"
+    write_utmp logout $pid null "$1"
+}
+
+# Step the wall-clock, as by date(1) or an NTP daemon.
+# 
+# @param  $1  The number of seconds to step the clock,
+#             negative to step it backwards.
+step ()
+{
+    read real boot < "$T/clock"
+    write_utmp old-time 0 "" ""
+    echo "$(( real + $1 )) $boot" > "$T/clock"
+    write_utmp new-time 0 "" ""
+}
+
+# Send SIGHUP to the daemon, as when it is reconfigured.
+# The hook is a child of the daemon.
+hup ()
+{
+    kill -HUP $DAEMON
+}
+
+# Run the daemon in the foreground, until it halts the machine.
+# With a fake clock, this takes seconds, rather than days.
+# 
+# @param  ...  The arguments for autohaltd.
+run ()
+{
+    timeout 60 "$BIN/autohaltd" -f "$@" > "$T/out" 2> "$T/err"
+}
+
+# Fail the scenario.
+# 
+# @param  ...  A description of the failure.
+fail ()
+{
+    echo "$*" >&2
+    echo "--- stdout ---" >&2
+    cat "$T/out" >&2
+    echo "--- trace ---" >&2
+    "$BIN/autohalt" --trace >&2
+    exit 1
+}
+
+# Assert that the daemon halted the machine, at a time.
+# In a DEBUG build, shutdown(8) is echo(1), so the arguments
+# it would have been run with are printed.
+# 
+# @param  $1  The uptime at which the machine shall have
+#             been halted, in seconds since boot.
+# @param  $2  The reason of the last decision in the trace.
+expect_halt ()
+{
+    test "$(tail -n 1 "$T/out")" = "-h now" ||
+	fail "The machine was not halted"
+    read real boot < "$T/clock"
+    test $(( boot - BOOT_BOOTTIME )) = $1 ||
+	fail "The machine was halted at $(( boot - BOOT_BOOTTIME ))s, rather than at $1s"
+    expect_trace "uptime=$1s .* $2"
+}
+
+# Assert that the last record of the trace matches a pattern.
+# 
+# @param  $1  The basic regular expression.
+expect_trace ()
+{
+    "$BIN/autohalt" --trace | tail -n 1 | grep -q -- "$1" ||
+	fail "The last record of the trace does not match: $1"
+}
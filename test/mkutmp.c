@@ -0,0 +1,115 @@
+/**
+ * Copyright © 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utmpx.h>
+
+
+
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpadded"
+#endif
+/**
+ * The record types, by the names the scenarios use.
+ */
+static const struct
+{
+  const char* name;
+  short int type;
+} types[] = {
+  {"boot",     BOOT_TIME},
+  {"old-time", OLD_TIME},
+  {"new-time", NEW_TIME},
+  {"login",    USER_PROCESS},
+  {"logout",   DEAD_PROCESS},
+};
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+
+
+/**
+ * Write a record to a fake utmp file, for the scenarios
+ * that `make check` runs. Records are written as by
+ * login(1) and init(1), so a record replaces an earlier
+ * record with the same ID, or of the same clock type.
+ * With -a, the record is appended, as to wtmp.
+ * 
+ * @param   argc  The number of arguments in `argv`, 7 to 9.
+ * @param   argv  The name of the process, optionally followed
+ *                by -a, followed by the pathname of the file,
+ *                the type of the record, the process ID, the
+ *                terminal, the ID, and the time, in seconds
+ *                since the Epoch, optionally followed by the
+ *                host of a remote login.
+ * @return        0 on success, 1 on error, 2 on usage error.
+ */
+int main(int argc, char* argv[])
+{
+  const char* execname = *argv;
+  struct utmpx u;
+  size_t i;
+  int append = 0;
+  
+  if ((argc > 1) && !strcmp(argv[1], "-a"))
+    append = 1, argv++, argc--;
+  if ((argc != 7) && (argc != 8))
+    {
+      fprintf(stderr, "Usage: %s [-a] FILE TYPE PID LINE ID TIME [HOST]\n", execname);
+      return 2;
+    }
+  
+  memset(&u, 0, sizeof(u));
+  for (i = 0; i < sizeof(types) / sizeof(*types); i++)
+    if (!strcmp(argv[2], types[i].name))
+      break;
+  if (i == sizeof(types) / sizeof(*types))
+    {
+      fprintf(stderr, "%s: unknown record type: %s\n", execname, argv[2]);
+      return 2;
+    }
+  u.ut_type = types[i].type;
+  u.ut_pid = (pid_t)atoi(argv[3]);
+  strncpy(u.ut_line, argv[4], sizeof(u.ut_line));
+  strncpy(u.ut_id, argv[5], sizeof(u.ut_id));
+  if (u.ut_type == USER_PROCESS)
+    strncpy(u.ut_user, argv[5], sizeof(u.ut_user));
+  u.ut_tv.tv_sec = (__typeof__(u.ut_tv.tv_sec))atoll(argv[6]);
+  if (argc == 8)
+    strncpy(u.ut_host, argv[7], sizeof(u.ut_host));
+  
+  if (append)
+    {
+      updwtmpx(argv[1], &u);
+      return 0;
+    }
+  if (utmpxname(argv[1]))
+    goto fail;
+  setutxent();
+  if (pututxline(&u) == NULL)
+    goto fail;
+  endutxent();
+  return 0;
+  
+ fail:
+  perror(execname);
+  return 1;
+}